@@ -4,16 +4,24 @@
  *
  * Use NV-RAM to store alarms according the following memory structure:
  * - mem pos 0 contains token to reflect status of clock (set or not)
- * - mem pos 1 contains bits for alarm days reflecting days of week with
- *             alarm set (sunday = bit 1, monday = bit 2, ...)
+ * - mem pos 1 contains the alarm table version (0x82)
+ * - mem pos 2 contains the number of alarms (max 14)
+ * - mem pos 3 contains a CRC-8 over pos 1, 2 and the alarms
+ * - mem pos 4 to 45 contain the alarms, 3 bytes each and sorted by time of day:
+ *             minute of the day (11 bits) and a weekday mask (sunday = bit 0, monday = bit 1, ...)
  *             this corresponds to definition of the dow (day of week) variable of the DS1307 RTC class
  *             i.e. Sunday => RTCandA.dow=0; Saturday => RTCandA.dow=6
- * - mem pos 2 to 8 contain time of alarm for that respective day, 
- *             so pos 2 is for first day with bit n = 1 in alarm days bits store in pos 1
- * - time is stored in 5 minute resolution and is between 4:00 and 12:00 (no wake up in the afternoon!?)
- *             = 72 different values; for example 17 = 4:00 + 17 * 0:05 = 5:25;
+ *             bit 7 of the mask marks a one shot alarm that is removed after it has triggered
+ * - mem pos 46 to 52 contain the oscillator drift record, see calibrate():
+ *             drift in 0.01 ppm (int16), time2000 of the last calibration (uint32),
+ *             seconds the chip has been set back since then (int8), little endian
+ * - mem pos 53 to 55 contain the minute of the last reported alarm, see isAlarmTime():
+ *             minutes after 2000-01-01 modulo 2^24 (little endian), 0xFFFFFF = none
  *
- * Version: 0.5
+ * Tables of version 0.5 (alarm days bits in pos 1, 5 minute alarm codes from 4:00 in pos 2 to 8)
+ * are converted automatically on first use.
+ *
+ * Version: 0.7
  * Date 26/07/2012
  *
  *Version history:
@@ -22,6 +30,8 @@
  * 0.3 Setting of alarms debugged
  * 0.4 Removed alarmIsSetAddress
  * 0.5 Refactored into a library class DS1307newAlarms
+ * 0.6 Versioned alarm table with minute resolution, several alarms per day and one shot alarms
+ * 0.7 Alarms are compared as time2000, missed alarms are reported after a sleep or power loss
  *
  * Based on test sketch from DS1307new library by Peter Schmelzer and Oliver Kraus (version 1.21)
  * see original .cpp file header below
@@ -61,27 +71,203 @@
 // *********************************************
 // DEFINE
 // *********************************************
-#define DS1307_ID 0x68
+#if defined(BUFFER_LENGTH) && BUFFER_LENGTH < 32
+#define DS1307_WIRE_CHUNK (BUFFER_LENGTH - 1)  // data bytes per burst, one byte is the register address
+#else
+#define DS1307_WIRE_CHUNK 31
+#endif
+// 8 bit AVRs have no divider, the date kernels then divide by shift/subtract, see "Division free arithmetic"
+#ifndef DS1307_DIVISION_FREE
+#if defined(__AVR__)
+#define DS1307_DIVISION_FREE 1
+#else
+#define DS1307_DIVISION_FREE 0
+#endif
+#endif
+// accesses of publishTime() / readConsistent(): the AVR has one core and
+// the other context is an interrupt, there only the compiler could reorder
+#if defined(__AVR__)
+#define DS1307_LOAD(x, order) (x)
+#define DS1307_STORE(x, v, order) ((x) = (v))
+#define DS1307_FENCE(order) __asm__ __volatile__("" ::: "memory")
+#else
+#define DS1307_LOAD(x, order) __atomic_load_n(&(x), order)
+#define DS1307_STORE(x, v, order) __atomic_store_n(&(x), (v), order)
+#define DS1307_FENCE(order) __atomic_thread_fence(order)
+#endif
 //#define DEBUG 1
 
+// *********************************************
+// Compile time date and time
+// *********************************************
+/*
+  The compiler's date and time (__DATE__ = "Dec 26 2009", __TIME__ = "12:34:56")
+  are converted by constexpr functions, so that setDateTimeRTC() only has
+  to write the resulting register values. The calculations are the same
+  as in calculate_ydn(), calculate_cdn(), calculate_dow() and
+  calculate_time2000().
+*/
+// two ascii digits, a leading blank counts as 0 (__DATE__ = "Jan  1 2013")
+static constexpr uint8_t build_2digits(const char *p)
+{
+  return ( '0' <= p[0] && p[0] <= '9' ? p[0] - '0' : 0 ) * 10 + p[1] - '0';
+}
+
+// Jan Feb Mar Apr May Jun Jul Aug Sep Oct Nov Dec
+static constexpr uint8_t build_month_of(const char *date)
+{
+  return date[0] == 'J' ? ( date[1] == 'a' ? 1 : date[2] == 'n' ? 6 : 7 ) :
+         date[0] == 'F' ? 2 :
+         date[0] == 'A' ? ( date[2] == 'r' ? 4 : 8 ) :
+         date[0] == 'M' ? ( date[2] == 'r' ? 3 : 5 ) :
+         date[0] == 'S' ? 9 :
+         date[0] == 'O' ? 10 :
+         date[0] == 'N' ? 11 : 12;
+}
+
+static constexpr uint8_t build_is_leap_year(uint16_t y)
+{
+  return ( (y % 4 == 0) && (y % 100 != 0) ) || (y % 400 == 0) ? 1 : 0;
+}
+
+static constexpr uint16_t build_ydn_of(uint16_t y, uint8_t m, uint8_t d)
+{
+  return (m + 2) * 611 / 20 + d - 91 - ( m >= 3 ? 2 - build_is_leap_year(y) : 0 );
+}
+
+static constexpr uint16_t build_cdn_of(uint16_t y, uint16_t _ydn)
+{
+  return _ydn - 1 + (y - 2000) * 365 + (y - 2000 + 3) / 4 - (y - 2000 + 99) / 100 + (y - 2000 + 399) / 400;
+}
+
+static constexpr uint8_t build_bcd(uint8_t num)
+{
+  return (num / 10 * 16) + (num % 10);
+}
+
+static constexpr uint16_t build_year = 2000 + build_2digits(__DATE__ + 9);
+static constexpr uint8_t build_month = build_month_of(__DATE__);
+static constexpr uint8_t build_day = build_2digits(__DATE__ + 4);
+static constexpr uint8_t build_hour = build_2digits(__TIME__);
+static constexpr uint8_t build_minute = build_2digits(__TIME__ + 3);
+static constexpr uint8_t build_second = build_2digits(__TIME__ + 6);
+static constexpr uint16_t build_ydn = build_ydn_of(build_year, build_month, build_day);
+static constexpr uint16_t build_cdn = build_cdn_of(build_year, build_ydn);
+static constexpr uint8_t build_dow = (build_cdn + 6) % 7;
+static constexpr uint32_t build_time2000 = (((uint32_t)build_cdn * 24 + build_hour) * 60 + build_minute) * 60 + build_second;
+
+// register 0x00 - 0x06: seconds (CH = 0), minutes, hours (24h), dow (1..7), day, month, year
+static constexpr uint8_t build_time_registers[7] =
+{
+  build_bcd(build_second), build_bcd(build_minute), build_bcd(build_hour), build_bcd(build_dow + 1),
+  build_bcd(build_day), build_bcd(build_month), build_bcd(build_year - 2000)
+};
+
+// *********************************************
+// Text output
+// *********************************************
+// three letters per dow, 0 = sunday
+static const char weekday_abbreviations[] PROGMEM = "SUNMONTUEWEDTHUFRISAT";
+
+// write value with exactly digits decimal digits (leading zeros), no terminating 0
+static void put_decimal(char *p, uint16_t value, uint8_t digits)
+{
+  while( digits-- > 0 )
+  {
+    p[digits] = '0' + value % 10;
+    value /= 10;
+  }
+}
+
+// *********************************************
+// Alarm table
+// *********************************************
+/*
+  Alarm table in NVRAM
+    address 1     format version DS1307_ALARM_FORMAT
+    address 2     number of alarms n (0 .. DS1307_ALARM_MAX)
+    address 3     CRC-8 (polynomial 0x31, as used by Dallas/Maxim) over addresses 1, 2 and the alarms
+    address 4 ..  n alarms of 3 bytes, sorted ascending:
+                    byte 0    minute of the day, bits 10..3
+                    byte 1    minute of the day, bits 2..0 in bits 7..5, bits 4..0 are 0
+                    byte 2    weekday mask (bit 0 = sunday), bit 7 = one shot
+  The table is read with the header in front (table[0..2]), so it can be
+  written back in one piece.
+*/
+static uint8_t alarm_crc8(const uint8_t *data, uint8_t n, uint8_t crc)
+{
+  while( n-- > 0 )
+  {
+    crc ^= *data++;
+    for( uint8_t b = 0; b < 8; b++ )
+      crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+  }
+  return crc;
+}
+
+static uint16_t alarm_minute_of_day(const uint8_t *e)
+{
+  return ((uint16_t)e[0] << 3) | (e[1] >> 5);
+}
+
+// index of the first alarm at or after minute of day mod
+static uint8_t alarm_lower_bound(const uint8_t *entries, uint8_t n, uint16_t mod)
+{
+  uint8_t lo = 0, hi = n;
+  while( lo < hi )
+  {
+    uint8_t mid = (lo + hi) >> 1;
+    if ( alarm_minute_of_day(entries + mid * 3) < mod )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  return lo;
+}
+
+/*
+  First alarm at or after from (time2000), DS1307_NO_ALARM if there is
+  none within a week. *index is set to its position in the table. The
+  weekday is derived from from itself, 2000-01-01 was a saturday.
+*/
+static uint32_t alarm_search(const uint8_t *entries, uint8_t n, uint32_t from, uint8_t *index)
+{
+  uint32_t dayStart = from - from % 86400UL;
+  uint16_t fromMod = (from - dayStart + 59) / 60;
+  uint8_t d = (from / 86400UL + 6) % 7;
+  for( uint8_t k = 0; k <= 7 && n > 0; k++ )
+  {
+    for( uint8_t i = alarm_lower_bound(entries, n, fromMod); i < n; i++ )
+    {
+      if ( entries[i * 3 + 2] & (1 << d) )
+      {
+        *index = i;
+        return dayStart + alarm_minute_of_day(entries + i * 3) * 60UL;
+      }
+    }
+    fromMod = 0;
+    dayStart += 86400UL;
+    d = d == 6 ? 0 : d + 1;
+  }
+  return DS1307_NO_ALARM;
+}
+
 // *********************************************
 // Public functions
 // *********************************************
 
 /**
- * Clears alarm on given date.
+ * Clears the alarm on the given day of the week (0 = sunday). One shot alarms are not changed.
  */
 boolean DS1307new::clearAlarm( uint8_t dayOfWeek) {
-  // reset alarm address to 0xFF
-  uint8_t value = 0xFF;
-  setRAM( alarmCodeAddressOffset + dayOfWeek, &value, sizeof(uint8_t));  
-  // remove bit from alarm bits, but get latest alarmbits value first
-  getRAM( alarmBitsAddress, &value, sizeof(uint8_t));
-  uint8_t mask = 1;
-  mask = mask << dayOfWeek; // shift mask to dayOfWeek-th bit
-  value = value - mask; // only reset dayOfWeek-th bit
-  // reset alarm bit of this day of week alarm 
-  setRAM( alarmBitsAddress, &value, sizeof(uint8_t));  
+  if (dayOfWeek > 6) {
+    return false;
+  }
+  uint8_t table[DS1307_ALARM_TABLE_SIZE];
+  uint8_t n = loadAlarms( table);
+  removeWeekday( table, &n, 1 << dayOfWeek);
+  storeAlarms( table, n);
+  return true;
 }
 
 /**
@@ -97,89 +283,191 @@ boolean DS1307new::isTimeSet() {
 }
 
 /**
- * sets alarm on given date and time. Returns true if succeeeded.
+ * Sets the alarm of the given day of the week (0 = sunday) at alarmHour:alarmMinutes,
+ * replacing an earlier alarm of that day. Returns false if the time is invalid or
+ * the alarm table is full.
  */
 boolean DS1307new::setAlarm( uint8_t dayOfWeek, uint8_t alarmHour, uint8_t alarmMinutes) {
-  // calculate alarmCode
-  if (alarmHour >= 4 || alarmHour < 21) {
-    uint8_t alarmCode = (alarmHour - 4 ) * 12 + alarmMinutes / 5;
-    setAlarm (dayOfWeek, alarmCode);
-    return true;
-  } 
-  return false;
-}
-
-void DS1307new::setAlarm( uint8_t dayOfWeek, uint8_t alarmCode) {
-  // first set the proper alarm bit in NV-RAM
-  byte currentAlarmBits = 0;
-  getRAM( alarmBitsAddress, &currentAlarmBits, sizeof(uint8_t)); // get current value
-  byte alarmBitMask = 1 << dayOfWeek; 
-  currentAlarmBits = currentAlarmBits | alarmBitMask;
-  setRAM( alarmBitsAddress, &currentAlarmBits, sizeof(uint8_t));
-  // then set the corresponding alarmcode in right place in memory
-  setRAM( alarmCodeAddressOffset + dayOfWeek, &alarmCode, sizeof(uint8_t));
+  if (dayOfWeek > 6 || alarmHour > 23 || alarmMinutes > 59) {
+    return false;
+  }
+  uint8_t table[DS1307_ALARM_TABLE_SIZE];
+  uint8_t n = loadAlarms( table);
+  removeWeekday( table, &n, 1 << dayOfWeek);
+  boolean ok = insertAlarm( table, &n, alarmHour * 60 + alarmMinutes, 1 << dayOfWeek);
+  beginNvramBatch();
+  skipPastAlarms();
+  storeAlarms( table, n);
+  commit();
   
   #ifdef DEBUG
     Serial.print("Alarm set at ");
-    Serial.print(4+(alarmCode/12));
+    print2Decimals( alarmHour);
     Serial.print(":");
-    Serial.print((alarmCode - (alarmCode/12*12))*5, DEC);
-    Serial.print(" =alarmCode[");
-    Serial.print(alarmCode, DEC);
-    Serial.print("], alarmBitMask=");
-    Serial.print(alarmBitMask, BIN);
-    Serial.print(", currentAlarmBits=");
-    Serial.print(currentAlarmBits, BIN);
+    print2Decimals( alarmMinutes);
+    Serial.print(" on day ");
+    Serial.print(dayOfWeek, DEC);
+    Serial.print(", alarms=");
+    Serial.print(n, DEC);
     Serial.println();
   #endif
+  return ok;
+}
+
+/**
+ * Old style alarm code: number of 5 minute steps after 4:00 (0 = 4:00, 239 = 23:55).
+ */
+void DS1307new::setAlarm( uint8_t dayOfWeek, uint8_t alarmCode) {
+  if (alarmCode < 240) {
+    setAlarm( dayOfWeek, 4 + alarmCode / 12, (alarmCode % 12) * 5);
+  }
+}
+
+/**
+ * Adds an alarm at alarmHour:alarmMinutes on the days in weekdayMask (bit 0 = sunday ... bit 6 =
+ * saturday, DS1307_EVERY_DAY for all). A one shot alarm is removed after it has triggered once.
+ * An alarm at the same time is merged with the new one. Returns false if the time or mask is
+ * invalid or the table is full.
+ */
+boolean DS1307new::addAlarm( uint8_t alarmHour, uint8_t alarmMinutes, uint8_t weekdayMask, boolean oneShot) {
+  weekdayMask &= DS1307_EVERY_DAY;
+  if (alarmHour > 23 || alarmMinutes > 59 || weekdayMask == 0) {
+    return false;
+  }
+  uint8_t table[DS1307_ALARM_TABLE_SIZE];
+  uint8_t n = loadAlarms( table);
+  boolean ok = insertAlarm( table, &n, alarmHour * 60 + alarmMinutes, weekdayMask | (oneShot ? DS1307_ALARM_ONE_SHOT : 0));
+  beginNvramBatch();
+  skipPastAlarms();
+  storeAlarms( table, n);
+  commit();
+  return ok;
+}
+
+/**
+ * Removes the index-th alarm (alarms are sorted by time of day).
+ */
+boolean DS1307new::removeAlarm( uint8_t index) {
+  uint8_t table[DS1307_ALARM_TABLE_SIZE];
+  uint8_t n = loadAlarms( table);
+  if (index >= n) {
+    return false;
+  }
+  deleteAlarm( table, &n, index);
+  storeAlarms( table, n);
+  return true;
+}
+
+uint8_t DS1307new::getAlarmCount() {
+  uint8_t table[DS1307_ALARM_TABLE_SIZE];
+  return loadAlarms( table);
 }
 
+/**
+ * Returns the index-th alarm (alarms are sorted by time of day).
+ */
+boolean DS1307new::getAlarm( uint8_t index, uint8_t *alarmHour, uint8_t *alarmMinutes, uint8_t *weekdayMask, boolean *oneShot) {
+  uint8_t table[DS1307_ALARM_TABLE_SIZE];
+  uint8_t n = loadAlarms( table);
+  if (index >= n) {
+    return false;
+  }
+  const uint8_t *e = table + DS1307_ALARM_ENTRY_OFFSET + index * 3;
+  uint16_t mod = alarm_minute_of_day( e);
+  *alarmHour = mod / 60;
+  *alarmMinutes = mod % 60;
+  *weekdayMask = e[2] & DS1307_EVERY_DAY;
+  *oneShot = (e[2] & DS1307_ALARM_ONE_SHOT) != 0;
+  return true;
+}
+
+/**
+ * Returns true once for every alarm that is due, the oldest first. An alarm that passed while
+ * isAlarmTime() was not called (sleep, power loss) is reported late with isAlarmMissed() set,
+ * if it is not older than DS1307_ALARM_CATCH_UP. getAlarmTime2000() returns the time of the
+ * reported alarm. The minute of the last reported alarm is kept in NVRAM, so every alarm is
+ * reported once, also across a reset. Call it until it returns false to get all missed alarms.
+ */
 boolean DS1307new::isAlarmTime() {
-  boolean alarmTriggered = false;
-  uint8_t mask=1;
-  // get current alarm bits
-  uint8_t currentAlarmBits = 0; // stores the days of the week that alarm is set
-  getRAM( alarmBitsAddress, &currentAlarmBits, sizeof(uint8_t)); // get current value
-  // prepare mask
-  uint8_t currentDayOfWeek = dow;
-  uint8_t currentDayOfWeekMask = mask << currentDayOfWeek;
-  // check if alarm bit set for today
-  if ((currentAlarmBits & currentDayOfWeekMask) > 0) {
-    // OK alarm set for today
-    // get todays alarm code (alarm code is nr times 5 minutes past 4:00)
-    uint8_t alarmCode = 0;
-    getRAM( alarmCodeAddressOffset + currentDayOfWeek, &alarmCode, sizeof(uint8_t));
-    // lets calculate the alarm hour: there are 12 times 5 minutes in an hour and divide by twelve rounds to number of hours
-    uint8_t alarmHour = (uint8_t) alarmCode / 12; 
-    uint8_t alarmMinute = (alarmCode - alarmHour * 12) * 5; // so makes sure we get the remaining 5 minute periods after the alarm hour
-    alarmHour += 4; // add 4 hours because the alarm code starts counting at 4 o clock in the morning
-    #ifdef DEBUG
-      Serial.print("Alarm triggered time is ");
-      Serial.print(alarmTriggeredTime, DEC);
-      Serial.print(", current time is ");
-      print2Decimals( hour);
-      Serial.print(":");
-      print2Decimals( minute);
-      Serial.print(", alarm at ");
-      print2Decimals( alarmHour);
-      Serial.print(":");
-      print2Decimals( alarmMinute);
-      Serial.println();
-    #endif
-    if (alarmTriggeredTime==0 && hour >= alarmHour && minute >= alarmMinute) {
-      // trigger the alarm!
-      #ifdef DEBUG
-	Serial.println("Alarm time has passed!");
-      #endif
-      alarmTriggeredTime = micros();
-      alarmTriggered = true;
-    }
-    // switch of alarm trigger time at the start of a new day
-    if (hour == 0 && minute == 0) {
-      alarmTriggeredTime = 0;
-    }
+  if (nextAlarmTime2000() > time2000) {
+    return false;                         // usually answered by the cache, without reading the table
+  }
+  uint8_t table[DS1307_ALARM_TABLE_SIZE];
+  uint8_t n = loadAlarms( table);
+  uint8_t i;
+  uint32_t alarmTime = alarm_search( table + DS1307_ALARM_ENTRY_OFFSET, n, pendingAlarmFrom(), &i);
+  if (alarmTime == DS1307_NO_ALARM || alarmTime > time2000) {
+    return false;
+  }
+  #ifdef DEBUG
+    Serial.print("Alarm at ");
+    print2Decimals( (alarmTime / 60) % 1440 / 60);
+    Serial.print(":");
+    print2Decimals( (alarmTime / 60) % 60);
+    Serial.print(", current time is ");
+    print2Decimals( hour);
+    Serial.print(":");
+    print2Decimals( minute);
+    Serial.println();
+  #endif
+  alarmMissed = time2000 - alarmTime >= 60;
+  beginNvramBatch();
+  storeAlarmState( alarmTime);
+  if (table[DS1307_ALARM_ENTRY_OFFSET + i * 3 + 2] & DS1307_ALARM_ONE_SHOT) {
+    deleteAlarm( table, &n, i);
+    storeAlarms( table, n);
+  }
+  commit();
+  nextAlarmValid = false;
+  return true;
+}
+
+// true if the alarm reported by the last isAlarmTime() was not reported within its minute
+boolean DS1307new::isAlarmMissed() {
+  return alarmMissed;
+}
+
+// time2000 of the alarm reported by the last isAlarmTime()
+uint32_t DS1307new::getAlarmTime2000() {
+  return alarmLastFired;
+}
+
+/*
+  Returns the time2000 of the next alarm that has not been reported by
+  isAlarmTime() yet, DS1307_NO_ALARM if no alarm is set. The result is in
+  the past if an alarm is due or has been missed. The alarm table is
+  sorted by time of day, so the first candidate of a day is found with a
+  binary search. The result is cached until the alarms change, an alarm
+  is reported or drops out of the catch up window, or the clock goes
+  backwards.
+*/
+uint32_t DS1307new::nextAlarmTime2000() {
+  if (time2000 < 60) {
+    return DS1307_NO_ALARM;               // the time has not been read yet, nothing is cached
+  }
+  if (nextAlarmValid && time2000 >= nextAlarmFrom
+      && (nextAlarm == DS1307_NO_ALARM || time2000 - nextAlarm < DS1307_ALARM_CATCH_UP || nextAlarm > time2000)) {
+    return nextAlarm;
   }
-  return alarmTriggered;
+  uint8_t table[DS1307_ALARM_TABLE_SIZE];
+  uint8_t n = loadAlarms( table);
+  uint8_t i;
+  nextAlarm = alarm_search( table + DS1307_ALARM_ENTRY_OFFSET, n, pendingAlarmFrom(), &i);
+  nextAlarmFrom = time2000;
+  nextAlarmValid = true;
+  return nextAlarm;
+}
+
+// seconds from the current time2000 to the next alarm, 0 if it is due, DS1307_NO_ALARM if none is set
+uint32_t DS1307new::secondsUntilNextAlarm() {
+  uint32_t next = nextAlarmTime2000();
+  if (next == DS1307_NO_ALARM) {
+    return DS1307_NO_ALARM;
+  }
+  if (next <= time2000) {
+    return 0;
+  }
+  return next - time2000;
 }
 
 // routine to convert ascii numbers to unsigned integers
@@ -192,18 +480,36 @@ uint8_t DS1307new::convert2decimal(const char* p) {
 }
 
 void DS1307new::setDateTimeRTC() {
-  // first stop the clock
-  stopClock();
-  // use compiler time to set date/time
-  setDateTime(__DATE__, __TIME__);
-  // set the time
-  setTime();
-  // start the clcok after setting it
-  startClock();
+  // write the compile time clock registers in one burst, the CH bit is
+  // clear so the clock runs from the moment the burst has been written
+  loadDrift();                          // before the write, the record is checked against the old time
+  softClockValid = false;
+  fastPollValid = false;
+  chipWrites++;
+  wire().beginTransmission(deviceAddress);
+  wire().write((uint8_t)0x00);
+  wire().write(build_time_registers, sizeof(build_time_registers));
+  wire().endTransmission();
+  // fill the object with the values calculated by the compiler
+  second = build_second;
+  minute = build_minute;
+  hour = build_hour;
+  day = build_day;
+  month = build_month;
+  year = build_year;
+  ydn = build_ydn;
+  cdn = build_cdn;
+  dow = build_dow;
+  time2000 = build_time2000;
   // store time-is-set token in lowest NV-RAM address (=0x08)
   // note: addressing of NV-RAM is done from virtual address 0 onwards in DS1307_new library so that
   //       there is no risk of overwriting the clock registers between real address 0 and 0x08
-  setRAM(timeIsSetAddress, (uint8_t *)&aspectIsSetToken, sizeof(uint16_t));
+  beginNvramBatch();
+  setRAM(timeIsSetAddress, (uint8_t *)&aspectIsSetToken, sizeof(uint8_t));
+  rebaseDrift();
+  storeAlarmState(time2000 - time2000 % 60 - 60);
+  commit();
+  nextAlarmValid = false;
   #ifdef DEBUG
     Serial.println( "time is set and token registered");
   #endif
@@ -237,22 +543,189 @@ void DS1307new::setDateTime (const char* date, const char* time) {
 }
 
 void DS1307new::clearAlarmNvramMemory() {
-  //
-  setRAM( alarmBitsAddress, &zero, sizeof(uint8_t)); // clear alarm bits
-  byte memContent = 0xFF;
-  for (int i=alarmCodeAddressOffset; i<=alarmCodeAddressOffset+6; i++) {
-    setRAM( i, &memContent, sizeof(byte));
-  }
+  uint8_t table[DS1307_ALARM_TABLE_SIZE];
+  storeAlarms( table, 0);
   #ifdef DEBUG
     Serial.println("Alarm memory cleared");
   #endif
 }
 
+/*
+  Read the alarm table into table, returns the number of alarms. A table
+  in the old layout (weekday bits in address 1, one 5 minute code per
+  weekday in addresses 2..8) is converted and written back. A damaged
+  table is replaced by an empty one. In both cases the alarm state is
+  reset to the current minute once the time has been read.
+*/
+uint8_t DS1307new::loadAlarms(uint8_t *table)
+{
+  uint8_t n, d;
+  getRAM(DS1307_ALARM_ADDRESS, table, DS1307_ALARM_ENTRY_OFFSET);
+  n = table[1];
+  if ( table[0] == DS1307_ALARM_FORMAT && n <= DS1307_ALARM_MAX )
+  {
+    getRAM(DS1307_ALARM_ADDRESS + DS1307_ALARM_ENTRY_OFFSET, table + DS1307_ALARM_ENTRY_OFFSET, n * 3);
+    if ( alarm_crc8(table + DS1307_ALARM_ENTRY_OFFSET, n * 3, alarm_crc8(table, 2, 0)) == table[2] )
+      return n;
+    n = 0;
+  }
+  else if ( table[0] == DS1307_ALARM_FORMAT )
+  {
+    n = 0;
+  }
+  else
+  {
+    // old layout: codes of 24:00 and later (e.g. cleared 0xFF) are not used
+    uint8_t legacy[8];
+    getRAM(alarmBitsAddress, legacy, sizeof(legacy));
+    n = 0;
+    for( d = 0; d < 7; d++ )
+      if ( (legacy[0] & (1 << d)) && legacy[1 + d] < 240 )
+        insertAlarm(table, &n, 240 + legacy[1 + d] * 5, 1 << d);
+  }
+  // the state bytes are not from this table: alarms from the current minute on count, as after setTime()
+  beginNvramBatch();
+  storeAlarms(table, n);
+  if ( time2000 >= 60 )
+    storeAlarmState(time2000 - time2000 % 60 - 60);
+  commit();
+  return n;
+}
+
+// fill in the header and write header and alarms as one batch, only changed bytes if the NVRAM is mirrored
+void DS1307new::storeAlarms(uint8_t *table, uint8_t n)
+{
+  table[0] = DS1307_ALARM_FORMAT;
+  table[1] = n;
+  table[2] = alarm_crc8(table + DS1307_ALARM_ENTRY_OFFSET, n * 3, alarm_crc8(table, 2, 0));
+  beginNvramBatch();
+  setRAM(DS1307_ALARM_ADDRESS, table, DS1307_ALARM_ENTRY_OFFSET + n * 3);
+  commit();
+  nextAlarmValid = false;
+}
+
+/*
+  The minute of the last reported alarm is stored in 3 bytes as minutes
+  after 2000-01-01 modulo 2^24 (32 years). The full value is the latest
+  one that is not after the current time. A stored value above the
+  current minute modulo 2^24 was not written by the library (or before
+  the minutes wrapped on 2031-11-24) and is replaced by the current
+  minute, like a missing state.
+*/
+void DS1307new::loadAlarmState(void)
+{
+  uint8_t rec[3];
+  uint32_t m, now;
+  if ( time2000 < 60 )
+    return;                             // the time has not been read yet, nothing is loaded or stored
+  getRAM(DS1307_ALARM_STATE_ADDRESS, rec, sizeof(rec));
+  m = rec[0] | ((uint16_t)rec[1] << 8) | ((uint32_t)rec[2] << 16);
+  now = time2000 / 60;
+  if ( m == DS1307_ALARM_NO_STATE || m > (now & DS1307_ALARM_NO_STATE) )
+  {
+    storeAlarmState(time2000 - time2000 % 60 - 60);   // first use: alarms from the current minute on count
+    return;
+  }
+  alarmLastFired = (now - ((now - m) & DS1307_ALARM_NO_STATE)) * 60;
+  alarmStateLoaded = true;
+}
+
+void DS1307new::storeAlarmState(uint32_t t)
+{
+  uint8_t rec[3];
+  uint32_t m = t / 60;
+  alarmLastFired = t;
+  alarmStateLoaded = true;
+  rec[0] = m;
+  rec[1] = m >> 8;
+  rec[2] = m >> 16;
+  setRAM(DS1307_ALARM_STATE_ADDRESS, rec, sizeof(rec));
+}
+
+// earliest time an alarm that has not been reported yet can have, DS1307_NO_ALARM before the time is read
+uint32_t DS1307new::pendingAlarmFrom(void)
+{
+  uint32_t minuteStart = time2000 - time2000 % 60;
+  uint32_t from;
+  if ( time2000 < 60 )
+    return DS1307_NO_ALARM;             // see skipPastAlarms()
+  if ( !alarmStateLoaded )
+    loadAlarmState();
+  if ( alarmLastFired > minuteStart )
+    storeAlarmState(minuteStart - 60);  // the clock has been set back, alarms repeat from now on
+  from = alarmLastFired + 60;
+  if ( from < time2000 && time2000 - from > DS1307_ALARM_CATCH_UP )
+    from = time2000 - DS1307_ALARM_CATCH_UP;
+  return from;
+}
+
+// an alarm that is added is not reported for times that have already passed
+void DS1307new::skipPastAlarms(void)
+{
+  uint32_t last;
+  if ( time2000 < 60 )
+    return;                             // the time has not been read yet
+  last = time2000 - time2000 % 60 - 60;
+  if ( pendingAlarmFrom() <= last )
+    storeAlarmState(last);
+}
+
+// insert an alarm at its sorted position, alarms with the same time and one shot flag are merged
+boolean DS1307new::insertAlarm(uint8_t *table, uint8_t *n, uint16_t mod, uint8_t mask)
+{
+  uint8_t *entries = table + DS1307_ALARM_ENTRY_OFFSET;
+  uint8_t i = alarm_lower_bound(entries, *n, mod);
+  for( uint8_t j = i; j < *n && alarm_minute_of_day(entries + j * 3) == mod; j++ )
+  {
+    if ( (entries[j * 3 + 2] & DS1307_ALARM_ONE_SHOT) == (mask & DS1307_ALARM_ONE_SHOT) )
+    {
+      entries[j * 3 + 2] |= mask;
+      return true;
+    }
+  }
+  if ( *n >= DS1307_ALARM_MAX )
+    return false;
+  memmove(entries + i * 3 + 3, entries + i * 3, (*n - i) * 3);
+  entries[i * 3] = mod >> 3;
+  entries[i * 3 + 1] = (mod & 7) << 5;
+  entries[i * 3 + 2] = mask;
+  (*n)++;
+  return true;
+}
+
+void DS1307new::deleteAlarm(uint8_t *table, uint8_t *n, uint8_t index)
+{
+  uint8_t *entries = table + DS1307_ALARM_ENTRY_OFFSET;
+  (*n)--;
+  memmove(entries + index * 3, entries + index * 3 + 3, (*n - index) * 3);
+}
+
+// remove the days in weekdayMask from all repeating alarms, alarms without days are deleted
+void DS1307new::removeWeekday(uint8_t *table, uint8_t *n, uint8_t weekdayMask)
+{
+  uint8_t *entries = table + DS1307_ALARM_ENTRY_OFFSET;
+  uint8_t i = 0;
+  while( i < *n )
+  {
+    uint8_t *e = entries + i * 3;
+    if ( (e[2] & DS1307_ALARM_ONE_SHOT) == 0 )
+    {
+      e[2] &= ~weekdayMask;
+      if ( e[2] == 0 )
+      {
+        deleteAlarm(table, n, i);
+        continue;
+      }
+    }
+    i++;
+  }
+}
+
 void DS1307new::listNvramMemory() {
   #ifdef DEBUG
     byte memContent = 0;
     Serial.println("DS1307 memory dump");
-    for (int i=0; i<=alarmCodeAddressOffset+6; i++) {
+    for (int i=0; i<DS1307_ALARM_ADDRESS+DS1307_ALARM_TABLE_SIZE; i++) {
       Serial.print("Mem loc[");
       Serial.print(i,HEX);
       Serial.print("]=");
@@ -263,129 +736,378 @@ void DS1307new::listNvramMemory() {
 }
 
 void DS1307new::print2Decimals( uint8_t number) {
-    if (number < 10) {
-      Serial.print("0");
-    } 
-    Serial.print(number, DEC);
+    char text[4];
+    uint8_t n = number < 100 ? 2 : 3;
+    put_decimal(text, number, n);
+    Serial.write((const uint8_t *)text, n);
 }  
 
 void DS1307new::printTime() {
   #ifdef DEBUG
-    print2Decimals( hour);
-    Serial.print(":");
-    print2Decimals( minute);
-    Serial.print(":");
-    print2Decimals( second);
-    Serial.print(" ");
-    print2Decimals( day);
-    Serial.print("-");
-    print2Decimals( month);
-    Serial.print("-");
-    print2Decimals( year);
-    Serial.print(" ");
-    switch (dow) {                    // Friendly printout the weekday
-      case 1:
-        Serial.print("MON");
-        break;
-      case 2:
-        Serial.print("TUE");
-        break;
-      case 3:
-        Serial.print("WED");
-        break;
-      case 4:
-        Serial.print("THU");
-        break;
-      case 5:
-        Serial.print("FRI");
-        break;
-      case 6:
-        Serial.print("SAT");
-        break;
-      case 7:
-        Serial.print("SUN");
-        break;
-    }
-    uint8_t CEST = isCETSummerTime();
-    Serial.print(" isCETSummerTime=");
-    Serial.print(CEST, DEC);  
-    
-    getRAM(timeIsSetAddress, (uint8_t *)&aspectIsSetTokenHolder, sizeof(uint8_t));
-    if (aspectIsSetTokenHolder == aspectIsSetToken)              // check if the clock was set or not
+    char line[72];
+    uint8_t n = formatTime(line, sizeof(line), "%H:%M:%S %d-%m-%Y %a isCETSummerTime=");
+    line[n++] = '0' + isCETSummerTime();
+    strcpy(line + n, isTimeSet() ? " - Clock was set!\r\n" : " - Clock was NOT set!\r\n");
+    Serial.write((const uint8_t *)line, strlen(line));   // one call per line
+  #endif
+}
+
+/*
+  Prototype:
+    uint8_t formatTime(char *buffer, uint8_t size, const char *layout)
+  Description:
+    Write the time of the object into buffer in a single pass, without
+    heap or Serial calls. layout is copied with these replacements:
+      %Y year (4 digits)    %m month      %d day        %j day of year (3 digits)
+      %H hour               %M minute     %S second     %a weekday (SUN .. SAT)
+      %% percent sign
+    All other fields have 2 digits. The text is always terminated. If
+    buffer is too small, it ends before the first number that does not fit.
+  Result:
+    length of the text without the terminating 0
+*/
+uint8_t DS1307new::formatTime(char *buffer, uint8_t size, const char *layout)
+{
+  char *p = buffer;
+  char *end = buffer + size - 1;
+  if ( size == 0 )
+    return 0;
+  while( *layout != '\0' && p < end )
+  {
+    char c = *layout++;
+    if ( c != '%' || *layout == '\0' )
     {
-      Serial.println(" - Clock was set!");
+      *p++ = c;
+      continue;
     }
-    else
+    c = *layout++;
+    uint16_t value;
+    uint8_t digits = 2;
+    switch( c )
     {
-      Serial.println(" - Clock was NOT set!");
-    }    
-  #endif
+      case 'Y': value = year; digits = 4; break;
+      case 'm': value = month; break;
+      case 'd': value = day; break;
+      case 'j': value = ydn; digits = 3; break;
+      case 'H': value = hour; break;
+      case 'M': value = minute; break;
+      case 'S': value = second; break;
+      case 'a':
+        for( uint8_t i = 0; i < 3 && p < end; i++ )
+          *p++ = pgm_read_byte(weekday_abbreviations + (dow % 7) * 3 + i);
+        continue;
+      default:                          // %% and unknown letters are copied
+        *p++ = c;
+        continue;
+    }
+    if ( p + digits > end )
+      break;
+    put_decimal(p, value, digits);
+    p += digits;
+  }
+  *p = '\0';
+  return p - buffer;
+}
+
+// ISO 8601 date and time, e.g. 2012-07-30T05:30:00, needs DS1307_ISO8601_SIZE bytes
+uint8_t DS1307new::formatISO8601(char *buffer, uint8_t size)
+{
+  return formatTime(buffer, size, "%Y-%m-%dT%H:%M:%S");
 }
 
 //original DS1307 library functions
 
-DS1307new::DS1307new()
+/*
+  The object only stores bus and address, the bus is started by the first
+  transfer. Several objects can share a bus or use different buses, e.g.
+    DS1307new RTC2(Wire1);
+  The software clock (enableSoftwareClock()) can be used by one object at a time.
+*/
+DS1307new::DS1307new(TwoWire &bus, uint8_t address)
 {
-  Wire.begin();
+  wireBus = &bus;
+  deviceAddress = address;
+  wireStarted = false;
   aspectIsSetToken = 0xa5;          // token used to flag that a certain aspect like time or alarms is set
   aspectIsNotSetToken = 0xff;       // token used to flag that a certain aspect like time or alarms is not set
   timeIsSetAddress = 0;       // first address of NVRAM is for time-is-set token
-  alarmBitsAddress = 1;       // third address contains bits that flag the days of the week with an alarm set
-  alarmCodeAddressOffset = 2; // offset where alarm codes are stored
+  alarmBitsAddress = 1;       // old layout: second address contains bits that flag the days of the week with an alarm set
+  alarmCodeAddressOffset = 2; // old layout: offset where alarm codes are stored
   aspectIsSetTokenHolder = 0;       // placeholder for the read token
   zero = 0;                         // zero variable to point to to pass zero to RTC
-  alarmTriggeredTime = 0;              // last time the alarm was triggered
+  fillByTime2000(0);                   // 2000-01-01 00:00:00 until the time is read
+  alarmLastFired = 0;                  // time2000 of the last reported alarm
+  alarmStateLoaded = false;
+  alarmMissed = false;
+  nextAlarm = DS1307_NO_ALARM;
+  nextAlarmFrom = 0;
+  nextAlarmValid = false;
+  nvramCached = false;
+  memset(nvramDirty, 0, sizeof(nvramDirty));
+  nvramBatchDepth = 0;
+  nvramAutoFlushMillis = DS1307_NVRAM_WRITE_THROUGH;
+  nvramDirtySince = 0;
+  timeZone = DS1307_TZ_CET;
+  dstYearBegin = 0;
+  dstYearEnd = 0;
+  dstBegin = 0;
+  dstEnd = 0;
+  softClockTicks = 0;
+  softClockEdgeMillis = 0;
+  softClockEdgeMicros = 0;
+  softClockPeriodMicros = 0;
+  softClockBase = 0;
+  softClockApplied = 0;
+  softClockResyncSeconds = 0;
+  softClockInterrupt = 0;
+  softClockEnabled = false;
+  softClockValid = false;
+  fastPollEnabled = false;
+  fastPollValid = false;
+  fastPollMillis = 0;
+  fastPollTime2000 = 0;
+  fastPollSecond = 0;
+  driftMode = DS1307_DRIFT_OFF;
+  drift = 0;
+  driftEpoch = DS1307_DRIFT_NO_EPOCH;
+  driftApplied = 0;
+  driftRangeLength = 0;
+  snapshotValid = false;
+  asyncState = DS1307_ASYNC_IDLE;
+  asyncRegister = 0;
+  asyncQuantity = 0;
+  asyncReceived = 0;
+  asyncTarget = 0;
+  asyncStart = 0;
+  publishedSequence = 0;
+  chipWrites = 0;
+}
+
+// the bus, started on first use
+TwoWire &DS1307new::wire(void)
+{
+  if ( !wireStarted )
+  {
+    wireBus->begin();
+    wireStarted = true;
+  }
+  return *wireBus;
 }
 
 uint8_t DS1307new::isPresent(void)         // check if the device is present
 {
-  Wire.beginTransmission(DS1307_ID);
-  Wire.write((uint8_t)0x00);
-  if (Wire.endTransmission() == 0) return 1;
+  wire().beginTransmission(deviceAddress);
+  wire().write((uint8_t)0x00);
+  if (wire().endTransmission() == 0) return 1;
   return 0;
 }
 
 void DS1307new::stopClock(void)         // set the ClockHalt bit high to stop the rtc
 {
-  Wire.beginTransmission(DS1307_ID);
-  Wire.write((uint8_t)0x00);                      // Register 0x00 holds the oscillator start/stop bit
-  Wire.endTransmission();
-  Wire.requestFrom(DS1307_ID, 1);
-  second = Wire.read() | 0x80;       // save actual seconds and OR sec with bit 7 (sart/stop bit) = clock stopped
-  Wire.beginTransmission(DS1307_ID);
-  Wire.write((uint8_t)0x00);
-  Wire.write((uint8_t)second);                    // write seconds back and stop the clock
-  Wire.endTransmission();
+  wire().beginTransmission(deviceAddress);
+  wire().write((uint8_t)0x00);                      // Register 0x00 holds the oscillator start/stop bit
+  wire().endTransmission();
+  wire().requestFrom((int)deviceAddress, 1);
+  second = wire().read() | 0x80;       // save actual seconds and OR sec with bit 7 (sart/stop bit) = clock stopped
+  chipWrites++;
+  wire().beginTransmission(deviceAddress);
+  wire().write((uint8_t)0x00);
+  wire().write((uint8_t)second);                    // write seconds back and stop the clock
+  wire().endTransmission();
 }
 
 void DS1307new::startClock(void)        // set the ClockHalt bit low to start the rtc
 {
-  Wire.beginTransmission(DS1307_ID);
-  Wire.write((uint8_t)0x00);                      // Register 0x00 holds the oscillator start/stop bit
-  Wire.endTransmission();
-  Wire.requestFrom(DS1307_ID, 1);
-  second = Wire.read() & 0x7f;       // save actual seconds and AND sec with bit 7 (sart/stop bit) = clock started
-  Wire.beginTransmission(DS1307_ID);
-  Wire.write((uint8_t)0x00);
-  Wire.write((uint8_t)second);                    // write seconds back and start the clock
-  Wire.endTransmission();
+  wire().beginTransmission(deviceAddress);
+  wire().write((uint8_t)0x00);                      // Register 0x00 holds the oscillator start/stop bit
+  wire().endTransmission();
+  wire().requestFrom((int)deviceAddress, 1);
+  second = wire().read() & 0x7f;       // save actual seconds and AND sec with bit 7 (sart/stop bit) = clock started
+  chipWrites++;
+  wire().beginTransmission(deviceAddress);
+  wire().write((uint8_t)0x00);
+  wire().write((uint8_t)second);                    // write seconds back and start the clock
+  wire().endTransmission();
 }
 
 // Aquire time from the RTC chip in BCD format and convert it to DEC
 void DS1307new::getTime(void)
 {
-  Wire.beginTransmission(DS1307_ID);
-  Wire.write((uint8_t)0x00);
-  Wire.endTransmission();
-  Wire.requestFrom(DS1307_ID, 7);       // request secs, min, hour, dow, day, month, year
-  second = bcd2dec(Wire.read() & 0x7f);// aquire seconds...
-  minute = bcd2dec(Wire.read());     // aquire minutes
-  hour = bcd2dec(Wire.read());       // aquire hours
-  dow = bcd2dec(Wire.read());        // aquire dow (Day Of Week)
+  snapshotValid = false;
+  if ( nvramCached )
+    autoFlushNvram();
+  if ( softClockEnabled )
+    getSoftTime();
+  else if ( fastPollEnabled )
+    getFastTime();
+  else
+    readTime();
+  publishTime();
+}
+
+// read the clock registers and recalculate all values
+void DS1307new::readTime(void)
+{
+  uint8_t regs[7];
+  if ( !readRegisters(0x00, regs, 7) )  // request secs, min, hour, dow, day, month, year
+    return;
+  acceptTime(regs);
+}
+
+// take the clock registers into the object
+void DS1307new::acceptTime(const uint8_t *regs)
+{
+  // the chip has ticked since a read at most DS1307_DRIFT_ADJUST_WINDOW ms ago
+  uint8_t next = fastPollSecond == 59 ? 0 : fastPollSecond + 1;
+  boolean ticked = fastPollValid && millis() - fastPollMillis <= DS1307_DRIFT_ADJUST_WINDOW;
+  decodeTime(regs);
+  ticked = ticked && (regs[0] & 0x80) == 0 && second == next;
+  fastPollSecond = second;
+  correctDrift(ticked);
+  fastPollMillis = millis();
+  fastPollTime2000 = time2000;
+  fastPollValid = true;
+}
+
+/*
+  Read the clock registers, the control register and the first NVRAM
+  bytes (time-set token and alarm table header, registers 0x00 - 0x0B)
+  in one burst: the register pointer is written once and the chip
+  increments it while the bytes are read. The object gets the time as
+  from getTime() (the software clock and the fast poll mode are not
+  used) and ctrl as from getCTRL(). Until the next getTime(),
+  snapshot() or a write to these NVRAM bytes, isTimeSet() and the alarm
+  table header are answered from the burst, so a loop of
+    RTC.snapshot(); RTC.isTimeSet(); RTC.isAlarmTime();
+  needs one transfer while no alarm is due. Returns false if the chip
+  does not answer, the object is then unchanged.
+*/
+boolean DS1307new::snapshot(void)
+{
+  uint8_t regs[8 + DS1307_SNAPSHOT_RAM];
+  if ( nvramCached )
+    autoFlushNvram();
+  snapshotValid = false;
+  if ( !readRegisters(0x00, regs, sizeof(regs)) )
+    return false;
+  acceptTime(regs);
+  ctrl = regs[7];
+  memcpy(snapshotRam, regs + 8, DS1307_SNAPSHOT_RAM);
+  snapshotValid = true;
+  publishTime();
+  return true;
+}
+
+/*
+  Prototype:
+    boolean getRegisters(uint8_t rtc_reg, uint8_t * buffer, uint8_t rtc_quantity)
+    boolean isRamHeld(uint8_t rtc_addr)
+    void fillByRegisters(const uint8_t *regs)
+    uint8_t getWriteCount(void)
+  Description:
+    Register level access for code that plans its own transfers, like
+    DS1307newScheduler. getRegisters() reads rtc_quantity registers from
+    rtc_reg on in one burst (at most the size of the Wire buffer). NVRAM
+    bytes the object holds newer values of are taken from the object, so
+    the result is what getRAM() would return: isRamHeld() tells which
+    NVRAM addresses (0 = register 0x08) those are, the whole NVRAM with
+    enableNvramCache(), else the writes of an open beginNvramBatch().
+    getRAM() answers them without a bus access. fillByRegisters() takes
+    the clock registers 0x00 - 0x06 as read from the chip into the object
+    like getTime() (drift compensation included, the software clock and
+    the fast poll mode are not used) and publishes the time for
+    readConsistent(). getWriteCount() counts the transfers of the object
+    that changed the chip (time, control register, NVRAM), modulo 256; a
+    copy of registers read before is stale once it has changed.
+  Result:
+    getRegisters(): false if the chip does not answer, the buffer is then
+    incomplete
+*/
+boolean DS1307new::getRegisters(uint8_t rtc_reg, uint8_t * buffer, uint8_t rtc_quantity)
+{
+  if ( !readRegisters(rtc_reg, buffer, rtc_quantity) )
+    return false;
+  for( uint8_t i = 0; i < rtc_quantity; i++ )
+    if ( rtc_reg + i >= 8 && isRamHeld(rtc_reg + i - 8) )
+      buffer[i] = nvram[rtc_reg + i - 8];
+  return true;
+}
+
+boolean DS1307new::isRamHeld(uint8_t rtc_addr)
+{
+  if ( rtc_addr >= DS1307_NVRAM_SIZE )
+    return false;
+  return nvramCached || (nvramDirty[rtc_addr >> 3] & (1 << (rtc_addr & 7)));
+}
+
+void DS1307new::fillByRegisters(const uint8_t *regs)
+{
+  snapshotValid = false;
+  acceptTime(regs);
+  publishTime();
+}
+
+uint8_t DS1307new::getWriteCount(void)
+{
+  return chipWrites;
+}
+
+/*
+  Fast mode of getTime(): only the seconds register is read (1 instead of
+  7 bytes) and the object is advanced by the difference with
+  addSeconds(). All registers are read again if
+    - the seconds wrapped or went backwards, so the minute, hour and
+      date registers are read at least once a minute and a clock set by
+      another master is seen within a minute,
+    - the seconds moved further than millis() allows (clock was set),
+    - the oscillator is halted,
+    - the last read is DS1307_FAST_POLL_MAX_GAP ms ago, so a whole
+      minute could have passed unnoticed,
+    - the sketch has changed the object since the last read.
+*/
+void DS1307new::enableFastPoll(void)
+{
+  fastPollValid = false;
+  fastPollEnabled = true;
+}
+
+void DS1307new::disableFastPoll(void)
+{
+  fastPollEnabled = false;
+}
+
+void DS1307new::getFastTime(void)
+{
+  uint8_t reg;
+  unsigned long now = millis();
+  unsigned long elapsed = now - fastPollMillis;
+  if ( fastPollValid && time2000 == fastPollTime2000 && elapsed < DS1307_FAST_POLL_MAX_GAP && readRegisters(0x00, &reg, 1) )
+  {
+    uint8_t s = bcd2dec(reg & 0x7f);
+    unsigned long delta = s - fastPollSecond;   // unsigned like elapsed, only used if s >= fastPollSecond
+    if ( (reg & 0x80) == 0 && s < 60 && s >= fastPollSecond && delta <= elapsed / 1000 + 1 )
+    {
+      addSeconds(delta);
+      fastPollSecond = s;
+      fastPollMillis = now;
+      fastPollTime2000 = time2000;
+      return;
+    }
+  }
+  readTime();
+}
+
+// convert the clock registers 0x00 - 0x06 from BCD and recalculate all other values
+void DS1307new::decodeTime(const uint8_t *regs)
+{
+  second = bcd2dec(regs[0] & 0x7f);// aquire seconds...
+  minute = bcd2dec(regs[1]);     // aquire minutes
+  hour = bcd2dec(regs[2]);       // aquire hours
+  dow = bcd2dec(regs[3]);        // aquire dow (Day Of Week)
   dow--;	//  correction from RTC format (1..7) to lib format (0..6). Useless, because it will be overwritten
-  day = bcd2dec(Wire.read());       // aquire day
-  month = bcd2dec(Wire.read());      // aquire month
-  year = bcd2dec(Wire.read());       // aquire year...
+  day = bcd2dec(regs[4]);       // aquire day
+  month = bcd2dec(regs[5]);      // aquire month
+  year = bcd2dec(regs[6]);       // aquire year...
   year = year + 2000;                   // ...and assume that we are in 21st century!
   
   // recalculate all other values
@@ -395,106 +1117,930 @@ void DS1307new::getTime(void)
   calculate_time2000();
 }
 
-// Set time to the RTC chip in BCD format
-void DS1307new::setTime(void)
+// time2000 of the clock registers 0x00 - 0x06, without changing an object
+uint32_t DS1307new::time2000_by_registers(const uint8_t *regs)
+{
+  uint16_t y = 2000 + bcd2dec(regs[6]);
+  uint32_t t = cdn_by_year_and_ydn(y, ydn_by_ymd(y, bcd2dec(regs[5]), bcd2dec(regs[4])));
+  return ((t * 24 + bcd2dec(regs[2])) * 60 + bcd2dec(regs[1])) * 60 + bcd2dec(regs[0] & 0x7f);
+}
+
+/*
+  Read rtc_quantity registers starting at rtc_reg. Returns false if the
+  device does not answer or the data does not arrive within
+  DS1307_I2C_TIMEOUT ms; the buffer is then incomplete.
+*/
+boolean DS1307new::readRegisters(uint8_t rtc_reg, uint8_t * buffer, uint8_t rtc_quantity)
+{
+  unsigned long start;
+  wire().beginTransmission(deviceAddress);
+  wire().write(rtc_reg);
+#if defined(ARDUINO) && ARDUINO >= 100
+  if ( wire().endTransmission(false) != 0 )  // repeated START: pointer write and read are one transfer
+#else
+  if ( wire().endTransmission() != 0 )
+#endif
+    return false;
+  if ( wire().requestFrom((int)deviceAddress, (int)rtc_quantity) != rtc_quantity )
+    return false;
+  start = millis();
+  for( uint8_t i = 0; i < rtc_quantity; i++ )
+  {
+    while( !wire().available() )
+    {
+      if ( millis() - start > DS1307_I2C_TIMEOUT )
+        return false;
+    }
+    buffer[i] = wire().read();
+  }
+  return true;
+}
+
+/*
+  Asynchronous reads: begin...() starts a transfer, every call of poll()
+  performs one step of it (write register pointer, request, collect
+  bytes), so the sketch can do other work in between. isReady() is true
+  once the data has arrived; for beginGetTime() the object is updated at
+  that moment. A transfer that has not finished within DS1307_I2C_TIMEOUT
+  ms ends with DS1307_ASYNC_ERROR. Note: the Arduino Wire library itself
+  blocks during a single transfer (up to about 1 ms at 100 kHz); the steps
+  are split at the transfer boundaries.
+*/
+boolean DS1307new::beginGetTime(void)
+{
+  return beginAsync(0x00, asyncBuffer, 7);
+}
+
+boolean DS1307new::beginGetRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity)
+{
+  rtc_addr &= 63;
+  if ( nvramCached && rtc_addr + rtc_quantity <= DS1307_NVRAM_SIZE && !isBusy() )
+  {
+    memcpy(rtc_ram, nvram + rtc_addr, rtc_quantity);
+    asyncState = DS1307_ASYNC_READY;
+    return true;
+  }
+  return beginAsync(rtc_addr + 8, rtc_ram, rtc_quantity);
+}
+
+boolean DS1307new::beginAsync(uint8_t rtc_reg, uint8_t * buffer, uint8_t rtc_quantity)
+{
+  if ( isBusy() )
+    return false;
+  asyncRegister = rtc_reg;
+  asyncTarget = buffer;
+  asyncQuantity = rtc_quantity;
+  asyncReceived = 0;
+  asyncStart = millis();
+  asyncState = DS1307_ASYNC_POINTER;
+  return true;
+}
+
+uint8_t DS1307new::poll(void)
+{
+  switch( asyncState )
+  {
+    case DS1307_ASYNC_POINTER:
+      wire().beginTransmission(deviceAddress);
+      wire().write(asyncRegister);
+      asyncState = wire().endTransmission() == 0 ? DS1307_ASYNC_REQUEST : DS1307_ASYNC_ERROR;
+      break;
+    case DS1307_ASYNC_REQUEST:
+      if ( wire().requestFrom((int)deviceAddress, (int)asyncQuantity) != asyncQuantity )
+        asyncState = DS1307_ASYNC_ERROR;
+      else
+        asyncState = DS1307_ASYNC_RECEIVE;
+      break;
+    case DS1307_ASYNC_RECEIVE:
+      while( asyncReceived < asyncQuantity && wire().available() )
+        asyncTarget[asyncReceived++] = wire().read();
+      if ( asyncReceived >= asyncQuantity )
+      {
+        if ( asyncTarget == asyncBuffer )
+        {
+          decodeTime(asyncBuffer);
+          correctDrift(false);
+          publishTime();
+        }
+        else                            // NVRAM bytes of the mirror or an open batch are newer, like getRAM()
+        {
+          for( uint8_t i = 0; i < asyncQuantity; i++ )
+            if ( asyncRegister + i >= 8 && isRamHeld(asyncRegister + i - 8) )
+              asyncTarget[i] = nvram[asyncRegister + i - 8];
+        }
+        asyncState = DS1307_ASYNC_READY;
+      }
+      break;
+  }
+  if ( isBusy() && millis() - asyncStart > DS1307_I2C_TIMEOUT )
+    asyncState = DS1307_ASYNC_ERROR;
+  return asyncState;
+}
+
+boolean DS1307new::isReady(void)
+{
+  return asyncState == DS1307_ASYNC_READY;
+}
+
+boolean DS1307new::isBusy(void)
+{
+  return asyncState == DS1307_ASYNC_POINTER || asyncState == DS1307_ASYNC_REQUEST || asyncState == DS1307_ASYNC_RECEIVE;
+}
+
+/*
+  Prototype:
+    void publishTime(void)
+    boolean readConsistent(DS1307newTime &t)
+  Description:
+    The fields of the object are plain members: if an interrupt handler
+    (or another thread) updates them while the main loop reads them, the
+    loop can see a mix of the old and the new time. publishTime() copies
+    the time fields into a second set guarded by a sequence counter, which
+    is odd while the copy is written. readConsistent() copies that set and
+    repeats if the counter was odd or has changed meanwhile, so it never
+    returns a torn time and neither side disables interrupts or waits
+    for a lock.
+    getTime(), snapshot() and the completion of beginGetTime() in poll()
+    publish the new time, a sketch that changes the fields itself calls
+    publishTime() afterwards. Only one context may publish. A reader must
+    not interrupt the publishing context (e.g. read in an ISR while the
+    main loop publishes): it would wait for a copy that cannot finish.
+  Result:
+    readConsistent(): false if no time has been published yet, t is then
+    unchanged
+*/
+void DS1307new::publishTime(void)
+{
+  DS1307newSequence s = publishedSequence;  // only this context writes it
+  DS1307_STORE(publishedSequence, (DS1307newSequence)(s + 1), __ATOMIC_RELAXED);  // odd: readers retry
+  DS1307_FENCE(__ATOMIC_RELEASE);
+  DS1307_STORE(published.time2000, time2000, __ATOMIC_RELAXED);
+  DS1307_STORE(published.year, year, __ATOMIC_RELAXED);
+  DS1307_STORE(published.month, month, __ATOMIC_RELAXED);
+  DS1307_STORE(published.day, day, __ATOMIC_RELAXED);
+  DS1307_STORE(published.hour, hour, __ATOMIC_RELAXED);
+  DS1307_STORE(published.minute, minute, __ATOMIC_RELAXED);
+  DS1307_STORE(published.second, second, __ATOMIC_RELAXED);
+  DS1307_STORE(published.dow, dow, __ATOMIC_RELAXED);
+  s += 2;
+  if ( s == 0 )
+    s = 2;                              // the counter wrapped, 0 means nothing published
+  DS1307_STORE(publishedSequence, s, __ATOMIC_RELEASE);
+}
+
+boolean DS1307new::readConsistent(DS1307newTime &t)
+{
+  DS1307newSequence s;
+  DS1307newTime copy;
+  do
+  {
+    do
+      s = DS1307_LOAD(publishedSequence, __ATOMIC_ACQUIRE);
+    while( s & 1 );                     // publishTime() is writing
+    if ( s == 0 )
+      return false;
+    copy.time2000 = DS1307_LOAD(published.time2000, __ATOMIC_RELAXED);
+    copy.year = DS1307_LOAD(published.year, __ATOMIC_RELAXED);
+    copy.month = DS1307_LOAD(published.month, __ATOMIC_RELAXED);
+    copy.day = DS1307_LOAD(published.day, __ATOMIC_RELAXED);
+    copy.hour = DS1307_LOAD(published.hour, __ATOMIC_RELAXED);
+    copy.minute = DS1307_LOAD(published.minute, __ATOMIC_RELAXED);
+    copy.second = DS1307_LOAD(published.second, __ATOMIC_RELAXED);
+    copy.dow = DS1307_LOAD(published.dow, __ATOMIC_RELAXED);
+    DS1307_FENCE(__ATOMIC_ACQUIRE);
+  } while( DS1307_LOAD(publishedSequence, __ATOMIC_RELAXED) != s );
+  t = copy;
+  return true;
+}
+
+/*
+  Software clock: the DS1307 outputs 1 Hz on SQW/OUT and every falling
+  edge advances the time by one second in the interrupt handler. getTime()
+  then only reads memory. The clock registers are read again after
+  resyncMinutes, or if no edge was seen for DS1307_SOFT_CLOCK_TIMEOUT ms.
+  SQW/OUT is open drain, the pin is configured with pull up. Only one
+  object can use the software clock at a time.
+*/
+void DS1307new::enableSoftwareClock(uint8_t interruptPin, uint8_t resyncMinutes)
+{
+  ctrl = 0x10;                          // SQWE = 1, RS1 = RS0 = 0: 1 Hz square wave
+  setCTRL();
+  pinMode(interruptPin, INPUT_PULLUP);
+  softClockInterrupt = digitalPinToInterrupt(interruptPin);
+  softClockResyncSeconds = (uint16_t)resyncMinutes * 60;
+  softClockValid = false;
+  softClockPeriodMicros = 0;
+  softClockInstance = this;
+  attachInterrupt(softClockInterrupt, softClockISR, FALLING);
+  softClockEnabled = true;
+}
+
+void DS1307new::disableSoftwareClock(void)
+{
+  if ( !softClockEnabled )
+    return;
+  detachInterrupt(softClockInterrupt);
+  softClockEnabled = false;
+  softClockInstance = 0;
+  ctrl = 0x00;                          // SQWE = 0, OUT = 0
+  setCTRL();
+}
+
+void DS1307new::softClockISR(void)
+{
+  DS1307new *rtc = softClockInstance;
+  if ( rtc == 0 )
+    return;
+  uint32_t now = micros();
+  uint32_t period = now - rtc->softClockEdgeMicros;   // the 32 bit difference is right across the wrap of micros()
+  rtc->softClockTicks++;
+  rtc->softClockEdgeMillis = millis();
+  if ( period >= DS1307_SQW_PERIOD_MIN && period <= DS1307_SQW_PERIOD_MAX )
+    rtc->softClockPeriodMicros = period;
+  rtc->softClockEdgeMicros = now;
+}
+
+/*
+  Prototype:
+    uint16_t getTimeMillis(void)
+  Description:
+    getTime() with sub-second resolution, needs enableSoftwareClock().
+    The falling SQW edge marks the start of a second, the ISR records
+    micros() of it. The milliseconds are interpolated from micros() since
+    the last edge and the measured length of the last second, so the
+    tolerance of the controller clock cancels out. The time of the object
+    and the result belong to the same second, also if an edge occurs
+    during the call. micros() wraps every 71 minutes, only differences of
+    it are used.
+  Result:
+    milliseconds within the current second (0..999), 0 if the software
+    clock is off or has not seen two edges yet
+*/
+uint16_t DS1307new::getTimeMillis(void)
+{
+  uint32_t ticks, edge, period, elapsed;
+  uint8_t i;
+  for( i = 0; i < 3; i++ )
+  {
+    getTime();
+    noInterrupts();
+    ticks = softClockTicks;
+    edge = softClockEdgeMicros;
+    period = softClockPeriodMicros;
+    elapsed = (uint32_t)micros() - edge;
+    interrupts();
+    if ( !softClockEnabled || !softClockValid || period == 0 )
+      return 0;
+    if ( ticks == softClockApplied )
+      break;                            // no edge since getTime()
+  }
+  if ( elapsed >= period )
+    return 999;                         // the next edge is late
+  return elapsed * 1000 / period;
+}
+
+void DS1307new::getSoftTime(void)
+{
+  uint32_t ticks;
+  unsigned long edge;
+  uint8_t i;
+  boolean unchanged;
+
+  noInterrupts();
+  ticks = softClockTicks;
+  edge = softClockEdgeMillis;
+  interrupts();
+  if ( softClockValid && ticks < softClockResyncSeconds && millis() - edge <= DS1307_SOFT_CLOCK_TIMEOUT )
+  {
+    if ( ticks != softClockApplied )
+    {
+      if ( time2000 == softClockBase + softClockApplied )
+        addSeconds(ticks - softClockApplied);   // usually a single tick
+      else
+        fillByTime2000(softClockBase + ticks);  // the sketch has changed the object
+      softClockApplied = ticks;
+    }
+    return;
+  }
+
+  // resync: if an edge arrives during the read, the registers may be from
+  // either side of it, so read again
+  softClockValid = false;
+  for( i = 0; i < 3; i++ )
+  {
+    readTime();
+    noInterrupts();
+    unchanged = softClockTicks == ticks;
+    if ( unchanged )
+    {
+      softClockTicks = 0;
+      softClockEdgeMillis = millis();
+    }
+    else
+    {
+      ticks = softClockTicks;
+    }
+    interrupts();
+    if ( unchanged )
+    {
+      softClockBase = time2000;
+      softClockApplied = 0;
+      softClockValid = true;
+      return;
+    }
+  }
+}
+
+// Set time to the RTC chip in BCD format
+void DS1307new::setTime(void)
+{
+  loadDrift();                          // before the write, the record is checked against the old time
+  writeTime(0x80);                      // clock is stopped, see startClock()
+  beginNvramBatch();
+  rebaseDrift();
+  storeAlarmState(time2000 - time2000 % 60 - 60);  // alarms before the new time are not missed
+  commit();
+  nextAlarmValid = false;
+}
+
+// write the object to the clock registers, halt is the CH bit (0x80 or 0)
+void DS1307new::writeTime(uint8_t halt)
+{
+  softClockValid = false;
+  fastPollValid = false;
+  chipWrites++;
+  wire().beginTransmission(deviceAddress);
+  wire().write((uint8_t)0x00);
+  wire().write(dec2bcd(second) | halt);    // set seconds
+  wire().write(dec2bcd(minute));           // set minutes
+  wire().write(dec2bcd(hour) & 0x3f);      // set hours (24h clock!)
+  wire().write(dec2bcd(dow+1));              // set dow (Day Of Week), do conversion from internal to RTC format
+  wire().write(dec2bcd(day));             // set day
+  wire().write(dec2bcd(month));            // set month
+  wire().write(dec2bcd(year-2000));             // set year
+  wire().endTransmission();
+}
+
+/*
+  Prototype:
+    boolean calibrate(uint32_t referenceTime2000)
+  Description:
+    Compare the chip with a reference time (NTP, GPS, a PC, ...) and set
+    the chip to it. If the previous calibration is at least
+    DS1307_DRIFT_MIN_INTERVAL s ago, the remaining error refines the drift
+    estimate: drift += error / elapsed time. Drift and calibration time
+    are kept in NVRAM 43..52. The error is measured in whole seconds, so
+    the resolution is 1 s over the interval: 11.6 ppm for one day, 1.7 ppm
+    for a week. Calls less than DS1307_DRIFT_MIN_INTERVAL after the
+    previous calibration change nothing. An error of more than
+    DS1307_DRIFT_LIMIT is not taken as drift: the chip is set and the
+    measurement starts again. The state of the CH bit is kept.
+  Result:
+    true if the drift estimate has been updated
+*/
+boolean DS1307new::calibrate(uint32_t referenceTime2000)
+{
+  uint8_t regs[7];
+  int32_t elapsed;
+  boolean updated = false;
+  loadDrift();
+  if ( !readRegisters(0x00, regs, 7) )
+    return false;
+  decodeTime(regs);
+  elapsed = referenceTime2000 - driftEpoch;
+  if ( driftEpoch != DS1307_DRIFT_NO_EPOCH )
+  {
+    if ( elapsed < (int32_t)DS1307_DRIFT_MIN_INTERVAL )
+      return false;
+    int32_t error = (int32_t)(time2000 - driftCorrection(time2000) - referenceTime2000);
+    int64_t estimate = drift + (int64_t)error * 100000000LL / elapsed;
+    if ( estimate >= -DS1307_DRIFT_LIMIT && estimate <= DS1307_DRIFT_LIMIT )
+    {
+      drift = estimate;
+      updated = true;
+    }
+  }
+  fillByTime2000(referenceTime2000);
+  writeTime(regs[0] & 0x80);
+  driftEpoch = referenceTime2000;
+  driftApplied = 0;
+  driftRangeLength = 0;
+  storeDrift();
+  return updated;
+}
+
+/*
+  DS1307_DRIFT_OFF       getTime() returns the chip time
+  DS1307_DRIFT_CORRECT   getTime() and the asynchronous read subtract the
+                         drift accumulated since the last calibration
+  DS1307_DRIFT_AUTO_SET  as DS1307_DRIFT_CORRECT, but once the correction
+                         reaches one second getTime() sets the chip. So
+                         that the write keeps the phase of the seconds,
+                         this is done by the first read that sees the
+                         seconds tick within DS1307_DRIFT_ADJUST_WINDOW ms
+                         of the previous read; getTime() does not wait for
+                         the tick. Until a read catches the tick the
+                         correction is only applied to the object.
+  Nothing is corrected before the first calibrate().
+*/
+void DS1307new::setDriftCompensation(uint8_t mode)
+{
+  loadDrift();
+  driftMode = mode;
+  fastPollValid = false;
+  softClockValid = false;
+}
+
+// estimated drift in 0.01 ppm, positive if the chip runs fast
+int16_t DS1307new::getDrift(void)
+{
+  loadDrift();
+  return drift;
+}
+
+/*
+  Drift record in NVRAM
+    address 43    format version DS1307_DRIFT_FORMAT
+    address 44    CRC-8 (as the alarm table) over addresses 43 and 45 .. 52
+    address 45    drift in 0.01 ppm, int16, low byte first
+    address 47    time2000 of the last calibration, low byte first
+    address 51    seconds the chip has been set back since then, int8
+    address 52    reserved, 0
+  Without a record nothing is corrected. A record with another format
+  byte or CRC (never calibrated, or NVRAM of an older layout), a drift
+  beyond DS1307_DRIFT_LIMIT or a calibration time after the time of the
+  chip is not used.
+*/
+void DS1307new::loadDrift(void)
+{
+  uint8_t rec[DS1307_DRIFT_RECORD_SIZE], regs[7];
+  int16_t d;
+  uint32_t epoch;
+  getRAM(DS1307_DRIFT_ADDRESS, rec, sizeof(rec));
+  driftEpoch = DS1307_DRIFT_NO_EPOCH;
+  drift = 0;
+  driftApplied = 0;
+  driftRangeLength = 0;
+  if ( rec[0] != DS1307_DRIFT_FORMAT || alarm_crc8(rec + 2, sizeof(rec) - 2, alarm_crc8(rec, 1, 0)) != rec[1] )
+    return;
+  d = rec[2] | (rec[3] << 8);
+  epoch = rec[4] | ((uint32_t)rec[5] << 8) | ((uint32_t)rec[6] << 16) | ((uint32_t)rec[7] << 24);
+  if ( d < -DS1307_DRIFT_LIMIT || d > DS1307_DRIFT_LIMIT || !readRegisters(0x00, regs, 7) || epoch > time2000_by_registers(regs) )
+    return;
+  drift = d;
+  driftEpoch = epoch;
+  driftApplied = rec[8];
+}
+
+void DS1307new::storeDrift(void)
+{
+  uint8_t rec[DS1307_DRIFT_RECORD_SIZE];
+  rec[0] = DS1307_DRIFT_FORMAT;
+  rec[2] = drift;
+  rec[3] = (uint16_t)drift >> 8;
+  rec[4] = driftEpoch;
+  rec[5] = driftEpoch >> 8;
+  rec[6] = driftEpoch >> 16;
+  rec[7] = driftEpoch >> 24;
+  rec[8] = driftApplied;
+  rec[9] = 0;
+  rec[1] = alarm_crc8(rec + 2, sizeof(rec) - 2, alarm_crc8(rec, 1, 0));
+  setRAM(DS1307_DRIFT_ADDRESS, rec, sizeof(rec));
+}
+
+// the time just written to the chip is taken as exact: a calibration restarts from it, the drift is kept
+void DS1307new::rebaseDrift(void)
+{
+  if ( driftEpoch == DS1307_DRIFT_NO_EPOCH )
+    return;
+  driftEpoch = time2000;
+  driftApplied = 0;
+  driftRangeLength = 0;
+  storeDrift();
+}
+
+/*
+  Seconds the chip at time t is ahead of the reference, minus what has
+  been corrected on the chip. The correction changes at most once per
+  10^8 / drift s (5000 s at DS1307_DRIFT_LIMIT): its value is kept with
+  the range of t it holds for, so the 64 bit division only runs when t
+  leaves that range, not on every getTime().
+*/
+int32_t DS1307new::driftCorrection(uint32_t t)
+{
+  int32_t elapsed = t - driftEpoch;
+  if ( driftEpoch == DS1307_DRIFT_NO_EPOCH || drift == 0 )
+    return 0;
+  if ( t - driftRangeStart < driftRangeLength )
+    return driftRangeValue - driftApplied;
+  driftRangeValue = (int64_t)drift * elapsed / 100000000LL;
+  if ( elapsed >= 0 )
+  {
+    // range of elapsed with the same quotient: [ceil(q 10^8 / |drift|), ceil((q + 1) 10^8 / |drift|))
+    int64_t magnitude = drift < 0 ? -drift : drift;
+    int64_t q = drift < 0 ? -driftRangeValue : driftRangeValue;
+    int64_t first = (q * 100000000LL + magnitude - 1) / magnitude;
+    int64_t end = ((q + 1) * 100000000LL + magnitude - 1) / magnitude;
+    if ( end > 0x80000000LL )
+      end = 0x80000000LL;               // elapsed turns negative there
+    driftRangeStart = driftEpoch + (uint32_t)first;
+    driftRangeLength = end - first;
+  }
+  else
+    driftRangeLength = 0;               // before the calibration, not kept
+  return driftRangeValue - driftApplied;
+}
+
+// apply the drift correction to the object decoded from the chip
+void DS1307new::correctDrift(boolean adjust)
+{
+  int32_t correction;
+  if ( driftMode == DS1307_DRIFT_OFF )
+    return;
+  correction = driftCorrection(time2000);
+  if ( correction == 0 )
+    return;
+  if ( adjust && driftMode == DS1307_DRIFT_AUTO_SET )
+  {
+    adjustChip(correction);
+    return;
+  }
+  fillByTime2000(time2000 - correction);
+}
+
+/*
+  Set the chip back by correction seconds. Called right after a read has
+  seen the seconds tick (see acceptTime()): writing the seconds register
+  restarts the divider chain of the chip, so the phase of the seconds is
+  kept within DS1307_DRIFT_ADJUST_WINDOW ms. The object receives the
+  corrected time. If the applied seconds do not fit into the record
+  anymore, the correction is taken as a calibration point.
+*/
+void DS1307new::adjustChip(int32_t correction)
+{
+  fillByTime2000(time2000 - correction);
+  writeTime(0);                         // the chip has just ticked, so it runs
+  fastPollSecond = second;
+  correction += driftApplied;
+  if ( correction < -128 || correction > 127 )
+  {
+    driftEpoch = time2000;
+    driftRangeLength = 0;
+    correction = 0;
+  }
+  driftApplied = correction;
+  storeDrift();
+}
+
+// Aquire data from the CTRL Register of the DS1307 (0x07)
+void DS1307new::getCTRL(void)
+{
+  uint8_t value;
+  if ( readRegisters(0x07, &value, 1) )   // read only CTRL Register
+    ctrl = value;                // ... and store it in ctrl
+}
+
+// Set data to CTRL Register of the DS1307 (0x07)
+void DS1307new::setCTRL(void)
+{
+  chipWrites++;
+  wire().beginTransmission(deviceAddress);
+  wire().write((uint8_t)0x07);                      // set CTRL Register Address
+  wire().write((uint8_t)ctrl);                      // set CTRL Register
+  wire().endTransmission();
+}
+
+// Aquire data from RAM of the RTC Chip (max 56 Byte)
+void DS1307new::getRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity)
+{
+  rtc_addr &= 63;                       // avoid wrong adressing
+  if ( rtc_addr + rtc_quantity > DS1307_NVRAM_SIZE )
+  {
+    sync();                             // request runs past the NVRAM, let the chip answer it
+    readRAM(rtc_addr, rtc_ram, rtc_quantity);
+    return;
+  }
+  if ( nvramCached )
+  {
+    memcpy(rtc_ram, nvram + rtc_addr, rtc_quantity);
+    return;
+  }
+  // writes of an open batch are newer than the chip, the chip is only asked for the other bytes
+  uint8_t pending = 0;
+  for( uint8_t i = 0; i < rtc_quantity; i++ )
+    if ( nvramDirty[(rtc_addr + i) >> 3] & (1 << ((rtc_addr + i) & 7)) )
+      pending++;
+  if ( pending < rtc_quantity )
+  {
+    if ( snapshotValid && rtc_addr + rtc_quantity <= DS1307_SNAPSHOT_RAM )
+      memcpy(rtc_ram, snapshotRam + rtc_addr, rtc_quantity);
+    else
+      readRAM(rtc_addr, rtc_ram, rtc_quantity);
+  }
+  for( uint8_t i = 0; pending > 0 && i < rtc_quantity; i++ )
+    if ( nvramDirty[(rtc_addr + i) >> 3] & (1 << ((rtc_addr + i) & 7)) )
+      rtc_ram[i] = nvram[rtc_addr + i];
+}
+
+// Write data into RAM of the RTC Chip
+void DS1307new::setRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity)
+{
+  rtc_addr &= 63;                       // avoid wrong adressing
+  if ( rtc_addr + rtc_quantity > DS1307_NVRAM_SIZE )
+  {
+    // request runs past the NVRAM: keep the order of writes and the mirror coherent, write through
+    sync();
+    for( uint8_t i = 0; nvramCached && rtc_addr + i < DS1307_NVRAM_SIZE; i++ )
+      nvram[rtc_addr + i] = rtc_ram[i];
+    writeRAM(rtc_addr, rtc_ram, rtc_quantity);
+    return;
+  }
+  if ( !nvramCached && nvramBatchDepth == 0 )
+  {
+    writeRAM(rtc_addr, rtc_ram, rtc_quantity);
+    return;
+  }
+  for( uint8_t i = 0; i < rtc_quantity; i++ )
+  {
+    uint8_t a = rtc_addr + i;
+    uint8_t bit = 1 << (a & 7);
+    if ( nvram[a] == rtc_ram[i] && (nvramCached || (nvramDirty[a >> 3] & bit)) )
+      continue;                         // unchanged bytes need no bus write
+    if ( !isNvramDirty() )
+      nvramDirtySince = millis();
+    nvram[a] = rtc_ram[i];
+    nvramDirty[a >> 3] |= bit;
+  }
+  autoFlushNvram();
+}
+
+/*
+  Keep a copy of the 56 byte NVRAM in the object. The NVRAM is read once,
+  after that getRAM() does not access the bus anymore and setRAM() only
+  modifies the copy and records the modified bytes. The modified bytes
+  are written back to the chip by sync() and by the flush policy:
+    DS1307_NVRAM_WRITE_THROUGH   every setRAM() is written immediately
+    DS1307_NVRAM_MANUAL_FLUSH    only sync() writes to the chip
+    any other value              modified bytes are written by the first
+                                 getTime() or setRAM() after they have
+                                 been pending for autoFlushMillis ms
+  Pending writes are lost if the controller resets before they are flushed.
+  Returns false if the NVRAM could not be read, the cache stays disabled.
+*/
+boolean DS1307new::enableNvramCache(uint16_t autoFlushMillis)
+{
+  sync();
+  if ( !readRAM(0, nvram, DS1307_NVRAM_SIZE) )
+    return false;
+  nvramAutoFlushMillis = autoFlushMillis;
+  nvramCached = true;
+  return true;
+}
+
+void DS1307new::disableNvramCache(void)
+{
+  sync();
+  nvramCached = false;
+}
+
+/*
+  Collect all setRAM() calls up to the matching commit() and write them
+  in one go. Nothing is written to the chip while a batch is open, getRAM()
+  already returns the new values. Batches nest, only the outermost commit()
+  writes. Works with and without enableNvramCache().
+*/
+void DS1307new::beginNvramBatch(void)
+{
+  nvramBatchDepth++;
+}
+
+void DS1307new::commit(void)
 {
-  Wire.beginTransmission(DS1307_ID);
-  Wire.write((uint8_t)0x00);
-  Wire.write(dec2bcd(second) | 0x80);   // set seconds (clock is stopped!)
-  Wire.write(dec2bcd(minute));           // set minutes
-  Wire.write(dec2bcd(hour) & 0x3f);      // set hours (24h clock!)
-  Wire.write(dec2bcd(dow+1));              // set dow (Day Of Week), do conversion from internal to RTC format
-  Wire.write(dec2bcd(day));             // set day
-  Wire.write(dec2bcd(month));            // set month
-  Wire.write(dec2bcd(year-2000));             // set year
-  Wire.endTransmission();
+  if ( nvramBatchDepth == 0 )
+    return;
+  nvramBatchDepth--;
+  if ( nvramBatchDepth == 0 && (!nvramCached || nvramAutoFlushMillis != DS1307_NVRAM_MANUAL_FLUSH) )
+    sync();
 }
 
-// Aquire data from the CTRL Register of the DS1307 (0x07)
-void DS1307new::getCTRL(void)
+/*
+  Write the modified bytes to the chip. Adjacent modified bytes are sent
+  as one burst. If the whole NVRAM is mirrored, a burst also covers gaps
+  of up to DS1307_NVRAM_MERGE_GAP unmodified bytes: resending them is
+  cheaper than the start, address and stop of another transfer.
+  writeRAM() splits bursts that do not fit the Wire buffer.
+*/
+void DS1307new::sync(void)
 {
-  Wire.beginTransmission(DS1307_ID);
-  Wire.write((uint8_t)0x07);                      // set CTRL Register Address
-  Wire.endTransmission();
-  Wire.requestFrom(DS1307_ID, 1);       // read only CTRL Register
-  while(!Wire.available())
+  uint8_t a = 0;
+  while( a < DS1307_NVRAM_SIZE )
   {
-    // waiting
+    if ( (nvramDirty[a >> 3] & (1 << (a & 7))) == 0 )
+    {
+      a++;
+      continue;
+    }
+    uint8_t end = a + 1;
+    for( uint8_t b = end; b < DS1307_NVRAM_SIZE; b++ )
+    {
+      if ( nvramDirty[b >> 3] & (1 << (b & 7)) )
+        end = b + 1;
+      else if ( !nvramCached || b + 1 - end > DS1307_NVRAM_MERGE_GAP )
+        break;
+    }
+    writeRAM(a, nvram + a, end - a);
+    a = end;
   }
-  ctrl = Wire.read();                // ... and store it in ctrl
+  memset(nvramDirty, 0, sizeof(nvramDirty));
 }
 
-// Set data to CTRL Register of the DS1307 (0x07)
-void DS1307new::setCTRL(void)
+void DS1307new::autoFlushNvram(void)
 {
-  Wire.beginTransmission(DS1307_ID);
-  Wire.write((uint8_t)0x07);                      // set CTRL Register Address
-  Wire.write((uint8_t)ctrl);                      // set CTRL Register
-  Wire.endTransmission();
+  if ( nvramBatchDepth > 0 || !isNvramDirty() || nvramAutoFlushMillis == DS1307_NVRAM_MANUAL_FLUSH )
+    return;
+  if ( nvramAutoFlushMillis == DS1307_NVRAM_WRITE_THROUGH || millis() - nvramDirtySince >= nvramAutoFlushMillis )
+    sync();
 }
 
-// Aquire data from RAM of the RTC Chip (max 56 Byte)
-void DS1307new::getRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity)
+boolean DS1307new::isNvramDirty(void)
+{
+  for( uint8_t i = 0; i < sizeof(nvramDirty); i++ )
+    if ( nvramDirty[i] )
+      return true;
+  return false;
+}
+
+// read NVRAM from the chip, rtc_addr is the NVRAM address (0 = register 0x08), false if the chip did not answer
+boolean DS1307new::readRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity)
 {
-  Wire.beginTransmission(DS1307_ID);
   rtc_addr &= 63;                       // avoid wrong adressing. Adress 0x08 is now address 0x00...
   rtc_addr += 8;                        // ... and address 0x3f is now 0x38
-  Wire.write(rtc_addr);                  // set CTRL Register Address
-  if ( Wire.endTransmission() != 0 )
-    return;
-  Wire.requestFrom(DS1307_ID, (int)rtc_quantity);
-  while(!Wire.available())
-  {
-    // waiting
-  }
-  for(int i=0; i<rtc_quantity; i++)     // Read x data from given address upwards...
+  while( rtc_quantity > 0 )             // in pieces that fit the Wire buffer
   {
-    rtc_ram[i] = Wire.read();        // ... and store it in rtc_ram
+    uint8_t n = rtc_quantity > DS1307_WIRE_CHUNK ? DS1307_WIRE_CHUNK : rtc_quantity;
+    if ( !readRegisters(rtc_addr & 63, rtc_ram, n) )
+      return false;
+    rtc_addr += n;
+    rtc_ram += n;
+    rtc_quantity -= n;
   }
+  return true;
 }
 
-// Write data into RAM of the RTC Chip
-void DS1307new::setRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity)
+// write NVRAM of the chip, rtc_addr is the NVRAM address (0 = register 0x08)
+void DS1307new::writeRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity)
 {
-  Wire.beginTransmission(DS1307_ID);
   rtc_addr &= 63;                       // avoid wrong adressing. Adress 0x08 is now address 0x00...
+  if ( rtc_addr < DS1307_SNAPSHOT_RAM || rtc_addr + rtc_quantity > DS1307_NVRAM_SIZE )
+    snapshotValid = false;              // the bytes of snapshot() change
+  chipWrites++;
   rtc_addr += 8;                        // ... and address 0x3f is now 0x38
-  Wire.write(rtc_addr);                  // set RAM start Address 
-  for(int i=0; i<rtc_quantity; i++)     // Send x data from given address upwards...
+  while( rtc_quantity > 0 )             // in pieces that fit the Wire buffer
   {
-    Wire.write(rtc_ram[i]);              // ... and send it from rtc_ram to the RTC Chip
+    uint8_t n = rtc_quantity > DS1307_WIRE_CHUNK ? DS1307_WIRE_CHUNK : rtc_quantity;
+    wire().beginTransmission(deviceAddress);
+    wire().write(rtc_addr & 63);          // set RAM start Address
+    for(int i=0; i<n; i++)              // Send x data from given address upwards...
+    {
+      wire().write(rtc_ram[i]);           // ... and send it from rtc_ram to the RTC Chip
+    }
+    wire().endTransmission();
+    rtc_addr += n;
+    rtc_ram += n;
+    rtc_quantity -= n;
   }
-  Wire.endTransmission();
 }
 
+// *********************************************
+// Division free arithmetic
+// *********************************************
+/*
+  The AVR has no divider, a 32 bit division is a library call of several
+  hundred cycles. With DS1307_DIVISION_FREE the date kernels divide by
+  their constants with one compare and subtract per quotient bit, take
+  the month offsets of Robertson's formula from a table and test
+  divisibility by multiplying with the inverse. The multiplications stay,
+  the AVR multiplies in hardware. The results equal those of the division
+  operators, "make divfree-check" in extras/host compares them for every
+  time2000, every day and every year.
+*/
+#if DS1307_DIVISION_FREE
+// quotient of *v and d, d_shifted is d << (bits - 1), the quotient must fit into bits; *v becomes the remainder
+static uint16_t divmod_u32(uint32_t *v, uint32_t d_shifted, uint8_t bits)
+{
+  uint16_t q = 0;
+  do
+  {
+    q <<= 1;
+    if ( *v >= d_shifted )
+    {
+      *v -= d_shifted;
+      q |= 1;
+    }
+    d_shifted >>= 1;
+  } while( --bits != 0 );
+  return q;
+}
+
+static uint16_t divmod_u16(uint16_t *v, uint16_t d_shifted, uint8_t bits)
+{
+  uint16_t q = 0;
+  do
+  {
+    q <<= 1;
+    if ( *v >= d_shifted )
+    {
+      *v -= d_shifted;
+      q |= 1;
+    }
+    d_shifted >>= 1;
+  } while( --bits != 0 );
+  return q;
+}
+
+// x % 7: 8 is 1 modulo 7, so the octal digits can be added up
+static uint8_t mod7_u16(uint16_t x)
+{
+  while( x > 7 )
+    x = (x >> 3) + (x & 7);
+  return x == 7 ? 0 : x;
+}
+
+// (m + 2) * 611 / 20 of Robertson's formula for m = 1 .. 12
+static const uint16_t robertson_month_offset[12] PROGMEM = { 91, 122, 152, 183, 213, 244, 274, 305, 336, 366, 397, 427 };
+
+static uint16_t month_offset(uint8_t m)
+{
+  if ( m >= 1 && m <= 12 )
+    return pgm_read_word(robertson_month_offset + m - 1);
+  uint16_t tmp = m;
+  tmp += 2;
+  tmp *= 611;
+  return divmod_u16(&tmp, 20U << 11, 12);   // invalid months, as the division would give
+}
+#endif
+
 /*
   Variable updates:
     cdn, ydn, year, month, day
 */
 void DS1307new::fillByCDN(uint16_t _cdn)
 {
-  uint16_t y, days_per_year;
   cdn = _cdn;
+  year = year_by_cdn(_cdn, &ydn);
+  calculate_dow();
+  calculate_month_by_year_and_ydn();
+  calculate_day_by_month_year_and_ydn();
+  calculate_time2000();
+}
+
+/*
+  Prototype:
+    uint16_t year_by_cdn(uint16_t _cdn, uint16_t *_ydn)
+  Description:
+    Inverse of cdn_by_year_and_ydn(), does not touch the object
+  Arguments:
+    _cdn        days since 2000-01-01 (2000-01-01 has the cdn 0)
+  Result:
+    year, *_ydn receives the year day number (1st of Jan has the number 1)
+*/
+uint16_t DS1307new::year_by_cdn(uint16_t _cdn, uint16_t *_ydn)
+{
+  uint16_t y, n;
   y = 2000;
-  for(;;)
+  if ( _cdn >= 366 )
   {
-    days_per_year = 365;
-    days_per_year += is_leap_year(y);
-    if ( _cdn >= days_per_year )
+    // 2000 is a leap year. From 2001-01-01 on the gregorian cycles start
+    // at a year boundary: 100 years = 36524 days, 4 years = 1461 days,
+    // 1 year = 365 days. A 400 year cycle (146097 days) does not fit into
+    // the 16 bit cdn, so that step is not needed.
+    _cdn -= 366;
+    y = 2001;
+    n = _cdn >= 36524;                  // _cdn / 36524, the 16 bit cdn covers less than two centuries
+    _cdn -= n * 36524;
+    y += n * 100;
+#if DS1307_DIVISION_FREE
+    y += divmod_u16(&_cdn, 1461U << 4, 5) * 4;   // _cdn < 36524: at most 24 cycles
+    n = divmod_u16(&_cdn, 365U << 2, 3);
+    if ( n == 4 )                       // 31st of Dec of the leap year at the end of a 4 year cycle
     {
-      _cdn -= days_per_year;
-      y++;
+      n = 3;
+      _cdn += 365;
     }
-    else
-      break;
+#else
+    n = _cdn / 1461;
+    _cdn -= n * 1461;
+    y += n * 4;
+    n = _cdn / 365;
+    if ( n == 4 )                       // 31st of Dec of the leap year at the end of a 4 year cycle
+      n = 3;
+    _cdn -= n * 365;
+#endif
+    y += n;
   }
   _cdn++;
-  year = y;
-  ydn = _cdn;
-  calculate_dow();
-  calculate_month_by_year_and_ydn();
-  calculate_day_by_month_year_and_ydn();
-  calculate_time2000();
+  *_ydn = _cdn;
+  return y;
 }
 
 /*
@@ -504,6 +2050,15 @@ void DS1307new::fillByCDN(uint16_t _cdn)
 void DS1307new::fillByTime2000(uint32_t _time2000)
 {
   time2000 = _time2000;
+#if DS1307_DIVISION_FREE
+  uint16_t days = divmod_u32(&_time2000, 86400UL << 15, 16);
+  uint16_t rest;
+  hour = divmod_u32(&_time2000, 3600UL << 4, 5);
+  rest = _time2000;
+  minute = divmod_u16(&rest, 60U << 5, 6);
+  second = rest;
+  fillByCDN(days);
+#else
   second = _time2000 % 60;
   _time2000 /= 60;
   minute = _time2000 % 60;
@@ -511,6 +2066,45 @@ void DS1307new::fillByTime2000(uint32_t _time2000)
   hour = _time2000 % 24;
   _time2000 /= 24;
   fillByCDN(_time2000);
+#endif
+}
+
+/*
+  Unix time and time2000 differ by a constant, the conversions are a
+  single addition. No time zone is applied: the result is in the time
+  scale the chip has been set to (see setTimeZone(), usually standard
+  time). time2000 runs until 2136, so the Unix time is 64 bit; the 32 bit
+  form time2000ToUnix32() is valid until 2106-02-07 06:28:15.
+  unixToTime2000() saturates times before 2000 to 0 and times after 2136
+  to DS1307_TIME2000_MAX.
+*/
+void DS1307new::fillByUnixTime(int64_t t)
+{
+  fillByTime2000(unixToTime2000(t));
+}
+
+int64_t DS1307new::unixTime(void)
+{
+  return time2000ToUnix(time2000);
+}
+
+int64_t DS1307new::time2000ToUnix(uint32_t _time2000)
+{
+  return (int64_t)_time2000 + DS1307_UNIX_OFFSET;
+}
+
+uint32_t DS1307new::time2000ToUnix32(uint32_t _time2000)
+{
+  return _time2000 + DS1307_UNIX_OFFSET;
+}
+
+uint32_t DS1307new::unixToTime2000(int64_t t)
+{
+  if ( t <= (int64_t)DS1307_UNIX_OFFSET )
+    return 0;
+  if ( t - DS1307_UNIX_OFFSET >= (int64_t)DS1307_TIME2000_MAX )
+    return DS1307_TIME2000_MAX;
+  return (uint32_t)(t - DS1307_UNIX_OFFSET);
 }
 
 void DS1307new::fillByHMS(uint8_t h, uint8_t m, uint8_t s)
@@ -536,37 +2130,398 @@ void DS1307new::fillByYMD(uint16_t y, uint8_t m, uint8_t d)
   calculate_time2000();
 }
 
+/*
+  Prototype:
+    void tick(void)
+  Description:
+    Advance the time by one second. Usually only second and time2000
+    change, the calendar fields are only touched at midnight.
+  Variable updates:
+    time2000, second, minute, hour and at midnight cdn, ydn, dow, day, month, year
+*/
+void DS1307new::tick(void)
+{
+  time2000++;
+  if ( ++second < 60 )
+    return;
+  second = 0;
+  if ( ++minute < 60 )
+    return;
+  minute = 0;
+  if ( ++hour < 24 )
+    return;
+  hour = 0;
+  nextDay();
+}
+
+/*
+  Prototype:
+    void addSeconds(int32_t s)
+  Description:
+    Advance the time by s seconds with carries into minute, hour and the
+    calendar. Negative values and steps of a day or more fall back to
+    fillByTime2000().
+*/
+void DS1307new::addSeconds(int32_t s)
+{
+  uint32_t sec;
+  if ( s < 0 || s >= 86400L )
+  {
+    fillByTime2000(time2000 + s);
+    return;
+  }
+  time2000 += s;
+  sec = second + (uint32_t)s;
+  if ( sec < 60 )
+  {
+    second = sec;
+    return;
+  }
+  second = sec % 60;
+  carryMinutes(sec / 60);
+}
+
+// as addSeconds(), negative values and steps of a day or more use fillByTime2000()
+void DS1307new::addMinutes(int32_t m)
+{
+  if ( m < 0 || m >= 1440 )
+  {
+    fillByTime2000(time2000 + m * 60);
+    return;
+  }
+  time2000 += m * 60;
+  carryMinutes(m);
+}
+
+// move the date by d days, the time of day stays the same
+void DS1307new::addDays(int32_t d)
+{
+  if ( d < 0 || d > 31 )
+  {
+    fillByCDN(cdn + d);
+    return;
+  }
+  time2000 += d * 86400L;
+  while( d-- > 0 )
+    nextDay();
+}
+
+// add m (less than 1500) minutes to minute and hour, without time2000
+void DS1307new::carryMinutes(uint16_t m)
+{
+  uint8_t h;
+  m += minute;
+  if ( m < 60 )
+  {
+    minute = m;
+    return;
+  }
+  h = m / 60;
+  minute = m - h * 60;
+  h += hour;
+  while( h >= 24 )
+  {
+    h -= 24;
+    nextDay();
+  }
+  hour = h;
+}
+
+// advance the calendar fields by one day, without time2000
+void DS1307new::nextDay(void)
+{
+  cdn++;
+  ydn++;
+  if ( ++dow > 6 )
+    dow = 0;
+  if ( ++day > 28 && day > days_in_month(year, month) )
+  {
+    day = 1;
+    if ( ++month > 12 )
+    {
+      month = 1;
+      year++;
+      ydn = 1;
+    }
+  }
+}
+
+/*
+  Prototype:
+    static void decodeTime2000Array(const uint32_t *t, const DS1307newTimeArrays &out, size_t n)
+  Description:
+    fillByTime2000() for n time stamps, the fields go to separate arrays.
+    The loop uses the same calculations as fillByTime2000(), but has no
+    calls and no data dependent loops, so that compilers can vectorise it
+    (e.g. g++ -O3 -mavx2). The arrays must not overlap.
+*/
+void DS1307new::decodeTime2000Array(const uint32_t *t, const DS1307newTimeArrays &out, size_t n)
+{
+  decode_time2000_array(t, out.year, out.month, out.day, out.hour, out.minute, out.second, out.dow, n);
+}
+
+// restrict on the parameters tells the compiler that the arrays do not overlap
+void DS1307new::decode_time2000_array(const uint32_t * __restrict__ t, uint16_t * __restrict__ year_out,
+  uint8_t * __restrict__ month_out, uint8_t * __restrict__ day_out, uint8_t * __restrict__ hour_out,
+  uint8_t * __restrict__ minute_out, uint8_t * __restrict__ second_out, uint8_t * __restrict__ dow_out, size_t n)
+{
+  for( size_t i = 0; i < n; i++ )
+  {
+    uint32_t v = t[i];
+    uint16_t days = v / 86400UL;
+    uint32_t seconds = v - days * 86400UL;
+    uint16_t y, yd, c;
+    uint8_t m;
+    second_out[i] = seconds % 60;
+    minute_out[i] = seconds / 60 % 60;
+    hour_out[i] = seconds / 3600;
+    dow_out[i] = (days + 6) % 7;
+    y = year_by_cdn(days, &yd);
+    c = corrected_ydn(y, yd);
+    m = month_by_corrected_ydn(c);
+    year_out[i] = y;
+    month_out[i] = m;
+    day_out[i] = day_by_month_and_corrected_ydn(m, c);
+  }
+}
+
+// inverse of decodeTime2000Array(), dow is not read
+void DS1307new::encodeTime2000Array(const DS1307newTimeArrays &in, uint32_t *t, size_t n)
+{
+  encode_time2000_array(in.year, in.month, in.day, in.hour, in.minute, in.second, t, n);
+}
+
+void DS1307new::encode_time2000_array(const uint16_t * __restrict__ year_in, const uint8_t * __restrict__ month_in,
+  const uint8_t * __restrict__ day_in, const uint8_t * __restrict__ hour_in, const uint8_t * __restrict__ minute_in,
+  const uint8_t * __restrict__ second_in, uint32_t * __restrict__ t, size_t n)
+{
+  for( size_t i = 0; i < n; i++ )
+  {
+    uint16_t y = year_in[i];
+    uint32_t c = cdn_by_year_and_ydn(y, ydn_by_ymd(y, month_in[i], day_in[i]));
+    t[i] = ((c * 24 + hour_in[i]) * 60 + minute_in[i]) * 60 + second_in[i];
+  }
+}
+
 // check if current time is central european summer time
+// (evaluates the configured time zone, which is DS1307_TZ_CET unless changed by setTimeZone())
 uint8_t DS1307new::isCETSummerTime(void)
 {
-  uint32_t current_time, summer_start, winter_start;
-  current_time = time2000;
-  
-  // calculate start of summer time
-  fillByYMD(year, 3, 30);
-  fillByHMS(2,0,0);
-  fillByCDN(RTC.cdn - RTC.dow);	// sunday before
-  summer_start = time2000;
-  
-  // calculate start of winter
-  fillByYMD(year, 10, 31);
-  fillByHMS(3,0,0);
-  fillByCDN(RTC.cdn - RTC.dow);	// sunday before
-  winter_start = time2000;
-  
-  // restore time
-  fillByTime2000(current_time);
-  
-  // return result
-  if ( summer_start <= current_time && current_time < winter_start )
-    return 1;
-  return 0;  
+  return isDST(time2000);
+}
+
+void DS1307new::setTimeZone(const DS1307newTimeZone &tz)
+{
+  timeZone = tz;
+  dstYearEnd = 0;                       // invalidate cache
+}
+
+/*
+  Parse a POSIX TZ string like "CET-1CEST,M3.5.0,M10.5.0/3" or
+  "EST5EDT,M3.2.0,M11.1.0". Only the Mm.w.d form of the rules and full
+  hours for the switch time are supported. Returns false (and keeps the
+  current time zone) if the string can not be used.
+*/
+static const char *tz_name(const char *p)
+{
+  if ( *p == '<' )
+  {
+    while( *p != '\0' && *p != '>' )
+      p++;
+    return *p == '>' ? p + 1 : 0;
+  }
+  const char *start = p;
+  while( (*p >= 'A' && *p <= 'Z') || (*p >= 'a' && *p <= 'z') )
+    p++;
+  return p - start >= 3 ? p : 0;
+}
+
+// [+|-]hh[:mm[:ss]] in minutes, seconds are ignored
+static const char *tz_time(const char *p, int16_t *minutes)
+{
+  int8_t sign = 1;
+  int16_t h = 0, m = 0;
+  if ( *p == '+' || *p == '-' )
+  {
+    if ( *p == '-' )
+      sign = -1;
+    p++;
+  }
+  if ( *p < '0' || *p > '9' )
+    return 0;
+  while( *p >= '0' && *p <= '9' )
+    h = h * 10 + *p++ - '0';
+  if ( *p == ':' )
+  {
+    p++;
+    while( *p >= '0' && *p <= '9' )
+      m = m * 10 + *p++ - '0';
+    if ( *p == ':' )
+    {
+      p++;
+      while( *p >= '0' && *p <= '9' )
+        p++;
+    }
+  }
+  *minutes = sign * (h * 60 + m);
+  return p;
+}
+
+// ,Mm.w.d[/time]
+static const char *tz_rule(const char *p, DS1307newDSTRule *rule)
+{
+  int16_t v[3] = { 0, 0, 0 };
+  int16_t t = 120;                      // default switch time 02:00
+  if ( p[0] != ',' || p[1] != 'M' )
+    return 0;
+  p += 2;
+  for( uint8_t i = 0; i < 3; i++ )
+  {
+    if ( i > 0 && *p++ != '.' )
+      return 0;
+    if ( *p < '0' || *p > '9' )
+      return 0;
+    while( *p >= '0' && *p <= '9' )
+      v[i] = v[i] * 10 + *p++ - '0';
+  }
+  if ( *p == '/' )
+  {
+    p = tz_time(p + 1, &t);
+    if ( p == 0 )
+      return 0;
+  }
+  if ( v[0] < 1 || v[0] > 12 || v[1] < 1 || v[1] > 5 || v[2] > 6 || t < 0 || t % 60 != 0 || t >= 24 * 60 )
+    return 0;
+  rule->month = v[0];
+  rule->week = v[1];
+  rule->dow = v[2];
+  rule->hour = t / 60;
+  return p;
+}
+
+boolean DS1307new::setTimeZone(const char *posixTZ)
+{
+  DS1307newTimeZone tz;
+  int16_t offset;
+  const char *p = tz_name(posixTZ);
+  if ( p == 0 || (p = tz_time(p, &offset)) == 0 )
+    return false;
+  memset(&tz, 0, sizeof(tz));
+  tz.stdOffset = -offset;               // POSIX counts west of UTC
+  tz.dstOffset = tz.stdOffset;
+  if ( *p != '\0' )
+  {
+    p = tz_name(p);
+    if ( p == 0 )
+      return false;
+    tz.dstOffset = tz.stdOffset + 60;
+    if ( *p != ',' && *p != '\0' )
+    {
+      p = tz_time(p, &offset);
+      if ( p == 0 )
+        return false;
+      tz.dstOffset = -offset;
+    }
+    if ( (p = tz_rule(p, &tz.dstStart)) == 0 || (p = tz_rule(p, &tz.dstEnd)) == 0 || *p != '\0' )
+      return false;
+  }
+  setTimeZone(tz);
+  return true;
+}
+
+uint8_t DS1307new::isDST(void)
+{
+  return isDST(time2000);
+}
+
+/*
+  Returns 1 if daylight saving time is in effect at _time2000 (standard
+  time). The switch times of a year are calculated once, after that a
+  query within the same year costs two compares. Does not change the
+  date and time fields of the object.
+*/
+uint8_t DS1307new::isDST(uint32_t _time2000)
+{
+  if ( timeZone.dstStart.month == 0 )
+    return 0;
+  if ( _time2000 < dstYearBegin || _time2000 >= dstYearEnd )
+    calculate_dst_cache(_time2000);
+  if ( dstBegin <= dstEnd )
+    return dstBegin <= _time2000 && _time2000 < dstEnd ? 1 : 0;
+  return _time2000 < dstEnd || dstBegin <= _time2000 ? 1 : 0;   // southern hemisphere
+}
+
+// local wall clock time of the current time, the object is not changed
+uint32_t DS1307new::localTime2000(void)
+{
+  return localTime2000(time2000);
 }
 
+uint32_t DS1307new::localTime2000(uint32_t _time2000)
+{
+  if ( isDST(_time2000) )
+    return _time2000 + (int32_t)(timeZone.dstOffset - timeZone.stdOffset) * 60;
+  return _time2000;
+}
+
+// offset to UTC in minutes at _time2000 (standard time)
+int16_t DS1307new::utcOffset(uint32_t _time2000)
+{
+  return isDST(_time2000) ? timeZone.dstOffset : timeZone.stdOffset;
+}
 
 // *********************************************
 // Private functions
 // *********************************************
+/*
+  Fill the daylight saving time cache with the switch times of the year
+  that contains _time2000. All values are standard time; the end rule is
+  given in daylight saving time and is corrected by the difference of the
+  offsets.
+*/
+void DS1307new::calculate_dst_cache(uint32_t _time2000)
+{
+  uint16_t y, _ydn, c;
+  int32_t shift;
+  y = year_by_cdn(_time2000 / 86400UL, &_ydn);
+  c = cdn_by_year_and_ydn(y, 1);
+  dstYearBegin = (uint32_t)c * 86400UL;
+  c = cdn_by_year_and_ydn(y + 1, 1);
+  dstYearEnd = c < 49711U ? (uint32_t)c * 86400UL : 0xffffffffUL;  // last year ends at the 32 bit limit
+  dstBegin = time2000_by_rule(y, timeZone.dstStart);
+  dstEnd = time2000_by_rule(y, timeZone.dstEnd);
+  shift = (int32_t)(timeZone.dstOffset - timeZone.stdOffset) * 60;
+  if ( shift > 0 && (uint32_t)shift > dstEnd )
+    dstEnd = 0;
+  else
+    dstEnd -= shift;
+}
+
+// time2000 of the day and hour described by rule in year y
+uint32_t DS1307new::time2000_by_rule(uint16_t y, const DS1307newDSTRule &rule)
+{
+  uint16_t c, _dow;
+  if ( rule.week >= 5 )
+  {
+    // last day of the month: one day before the 1st of the next month
+    if ( rule.month >= 12 )
+      c = cdn_by_year_and_ydn(y + 1, 1);
+    else
+      c = cdn_by_year_and_ydn(y, ydn_by_ymd(y, rule.month + 1, 1));
+    c--;
+    _dow = (c + 6) % 7;
+    c -= (_dow + 7 - rule.dow) % 7;
+  }
+  else
+  {
+    c = cdn_by_year_and_ydn(y, ydn_by_ymd(y, rule.month, 1));
+    _dow = (c + 6) % 7;
+    c += (rule.dow + 7 - _dow) % 7;
+    c += (rule.week - 1) * 7;
+  }
+  return (uint32_t)c * 86400UL + (uint32_t)rule.hour * 3600UL;
+}
+
 // Convert Decimal to Binary Coded Decimal (BCD)
 uint8_t DS1307new::dec2bcd(uint8_t num)
 {
@@ -592,12 +2547,27 @@ uint8_t DS1307new::bcd2dec(uint8_t num)
 */
 uint8_t DS1307new::is_leap_year(uint16_t y)
 {
+#if DS1307_DIVISION_FREE
+   // y % 100 != 0 for a multiple of 4 is y % 25 != 0: y * 25^-1 (mod 2^16) > 65535 / 25;
+   // y % 400 == 0 is y % 100 == 0 and y % 16 == 0
+   if ( (y & 3) == 0 && ((uint16_t)(y * 0x5c29U) > 0x0a3dU || (y & 15) == 0) )
+      return 1;
+   return 0;
+#else
    if ( 
           ((y % 4 == 0) && (y % 100 != 0)) || 
           (y % 400 == 0) 
       )
       return 1;
    return 0;
+#endif
+}
+
+uint8_t DS1307new::days_in_month(uint16_t y, uint8_t m)
+{
+  if ( m == 2 )
+    return 28 + is_leap_year(y);
+  return 30 + ((m + (m >> 3)) & 1);    // 31 days in jan, mar, may, jul, aug, oct, dec
 }
 
 /*
@@ -614,23 +2584,32 @@ uint8_t DS1307new::is_leap_year(uint16_t y)
     this->ydn		The "day number" within the year: 1 for the 1st of Jan.
 */
 void DS1307new::calculate_ydn(void)
+{
+  ydn = ydn_by_ymd(year, month, day);
+}
+
+uint16_t DS1307new::ydn_by_ymd(uint16_t y, uint8_t m, uint8_t d)
 {
   uint8_t tmp1; 
   uint16_t tmp2;
   tmp1 = 0;
-  if ( month >= 3 )
+  if ( m >= 3 )
     tmp1++;
-  tmp2 = month;
+#if DS1307_DIVISION_FREE
+  tmp2 = month_offset(m);
+#else
+  tmp2 = m;
   tmp2 +=2;
   tmp2 *=611;
   tmp2 /= 20;
-  tmp2 += day;
+#endif
+  tmp2 += d;
   tmp2 -= 91;
   tmp1 <<=1;
   tmp2 -= tmp1;
   if ( tmp1 != 0 )
-    tmp2 += is_leap_year(year);
-  ydn = tmp2;
+    tmp2 += is_leap_year(y);
+  return tmp2;
 }
 
 /*
@@ -646,15 +2625,30 @@ void DS1307new::calculate_ydn(void)
 */
 void DS1307new::calculate_cdn(void)
 {
-  uint16_t y = year;
-  cdn = ydn;
-  cdn--;
-  while( y > 2000 )
-  {
-    y--;
-    cdn += 365;
-    cdn += is_leap_year(y);
-  }
+  cdn = cdn_by_year_and_ydn(year, ydn);
+}
+
+uint16_t DS1307new::cdn_by_year_and_ydn(uint16_t y, uint16_t _ydn)
+{
+  uint16_t c;
+  if ( y > 2000 )
+    y -= 2000;                          // number of completed years since 2000
+  else
+    y = 0;
+  c = _ydn;
+  c--;
+  c += y * 365;
+  c += (y + 3) / 4;                     // leap years 2000, 2004, ... before this year
+#if DS1307_DIVISION_FREE
+  uint16_t v = y + 99;
+  c -= divmod_u16(&v, 100U << 9, 10);
+  v = y + 399;
+  c += divmod_u16(&v, 400U << 7, 8);
+#else
+  c -= (y + 99) / 100;                  // ... except 2100, 2200, ...
+  c += (y + 399) / 400;                 // ... but including 2400, ...
+#endif
+  return c;
 }
 
 /*
@@ -668,8 +2662,12 @@ void DS1307new::calculate_dow(void)
   uint16_t tmp;
   tmp = cdn;
   tmp += 6;
+#if DS1307_DIVISION_FREE
+  dow = mod7_u16(tmp);
+#else
   tmp %= 7;
   dow = tmp;
+#endif
 }
 
 /*
@@ -696,17 +2694,22 @@ void DS1307new::calculate_time2000(void)
 
 
 uint16_t DS1307new::_corrected_year_day_number(void)
+{
+   return corrected_ydn(year, ydn);
+}
+
+// day number counted from the 1st of Mar of the year before, plus 91 (Robertson)
+uint16_t DS1307new::corrected_ydn(uint16_t y, uint16_t _ydn)
 {
    uint8_t a;
-   uint16_t corrected_ydn = ydn;
-   a = is_leap_year(year);
-   if ( corrected_ydn > (uint8_t)(((uint8_t)59)+a) )
+   a = is_leap_year(y);
+   if ( _ydn > (uint8_t)(((uint8_t)59)+a) )
    {
-      corrected_ydn += 2;
-      corrected_ydn -= a;
+      _ydn += 2;
+      _ydn -= a;
    }
-   corrected_ydn += 91;
-   return corrected_ydn;
+   _ydn += 91;
+   return _ydn;
 }
 
 /*
@@ -716,15 +2719,22 @@ uint16_t DS1307new::_corrected_year_day_number(void)
     month
 */
 void DS1307new::calculate_month_by_year_and_ydn(void)
+{
+  month = month_by_corrected_ydn(_corrected_year_day_number());
+}
+
+uint8_t DS1307new::month_by_corrected_ydn(uint16_t c_ydn)
 {
   uint8_t a;
-  uint16_t c_ydn;
-  c_ydn = _corrected_year_day_number();
   c_ydn *= 20;
+#if DS1307_DIVISION_FREE
+  a = divmod_u16(&c_ydn, 611U << 6, 7);  // 611 * 128 is above every 16 bit value
+#else
   c_ydn /= 611;
   a = c_ydn;
+#endif
   a -= 2;
-  month = a;  
+  return a;
 }
 
 /*
@@ -735,22 +2745,41 @@ void DS1307new::calculate_month_by_year_and_ydn(void)
 */
 void DS1307new::calculate_day_by_month_year_and_ydn(void)
 {
-  uint8_t m;
-  uint16_t tmp, c_ydn;
-  m = month;
+  day = day_by_month_and_corrected_ydn(month, _corrected_year_day_number());
+}
+
+uint8_t DS1307new::day_by_month_and_corrected_ydn(uint8_t m, uint16_t c_ydn)
+{
+  uint16_t tmp;
+#if DS1307_DIVISION_FREE
+  tmp = month_offset(m);
+#else
   m += 2;
-  c_ydn = _corrected_year_day_number();
   tmp = 611;
   tmp *= m;
   tmp /= 20;
+#endif
   c_ydn -= tmp;
-  day = c_ydn;
+  return c_ydn;
 }
 
 
 
 
+// *********************************************
+// Time zones
+// *********************************************
+// offsets in minutes east of UTC, rules: { month, week (5 = last), dow, hour }
+const DS1307newTimeZone DS1307_TZ_WET = {    0,   60, {  3, 5, 0, 1 }, { 10, 5, 0, 2 } };
+const DS1307newTimeZone DS1307_TZ_CET = {   60,  120, {  3, 5, 0, 2 }, { 10, 5, 0, 3 } };
+const DS1307newTimeZone DS1307_TZ_EET = {  120,  180, {  3, 5, 0, 3 }, { 10, 5, 0, 4 } };
+const DS1307newTimeZone DS1307_TZ_US_EASTERN = { -300, -240, {  3, 2, 0, 2 }, { 11, 1, 0, 2 } };
+const DS1307newTimeZone DS1307_TZ_US_CENTRAL = { -360, -300, {  3, 2, 0, 2 }, { 11, 1, 0, 2 } };
+const DS1307newTimeZone DS1307_TZ_US_MOUNTAIN = { -420, -360, {  3, 2, 0, 2 }, { 11, 1, 0, 2 } };
+const DS1307newTimeZone DS1307_TZ_US_PACIFIC = { -480, -420, {  3, 2, 0, 2 }, { 11, 1, 0, 2 } };
+
 // *********************************************
 // Define user object
 // *********************************************
+DS1307new *DS1307new::softClockInstance = 0;
 class DS1307new RTC;
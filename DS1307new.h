@@ -26,26 +26,190 @@
 #else
 #include "WProgram.h"
 #endif
+#include <Wire.h>
   
+// *********************************************
+// DEFINE
+// *********************************************
+#define DS1307_ID 0x68                       // default I2C address of the DS1307
+#define DS1307_NVRAM_SIZE 56                 // bytes of battery backed RAM (0x08 - 0x3F)
+#define DS1307_NVRAM_WRITE_THROUGH 0         // autoFlushMillis: write every setRAM() immediately
+#define DS1307_NVRAM_MANUAL_FLUSH 0xffff     // autoFlushMillis: write only on sync()
+#define DS1307_NVRAM_MERGE_GAP 2             // clean bytes a burst may rewrite to save a transfer, see sync()
+#define DS1307_ISO8601_SIZE 20               // buffer for formatISO8601(), including the terminating 0
+#define DS1307_NO_ALARM 0xffffffffUL         // nextAlarmTime2000(): no alarm is set
+#define DS1307_UNIX_OFFSET 946684800UL       // Unix time of 2000-01-01 00:00
+#define DS1307_TIME2000_MAX 0xffffffffUL     // last time2000: 2136-02-07 06:28:15
+
+// alarm table in NVRAM, see loadAlarms()
+#define DS1307_ALARM_ADDRESS 1               // NVRAM address of the table header
+#define DS1307_ALARM_FORMAT 0x82             // version byte of the table, bit 7 distinguishes it from the old weekday bits
+#define DS1307_ALARM_MAX 13                  // alarms in the table
+#define DS1307_ALARM_ENTRY_OFFSET 3          // version, count, crc
+#define DS1307_ALARM_TABLE_SIZE (DS1307_ALARM_ENTRY_OFFSET + 3 * DS1307_ALARM_MAX)  // NVRAM 1..42
+#define DS1307_ALARM_ONE_SHOT 0x80           // weekday mask flag: remove the alarm after it has triggered
+#define DS1307_EVERY_DAY 0x7f                // weekday mask of all days, bit 0 = sunday
+#define DS1307_ALARM_STATE_ADDRESS 53        // NVRAM 53..55: minute of the last reported alarm
+#define DS1307_ALARM_NO_STATE 0xffffffUL     // no alarm reported yet, also the mask of the stored minutes
+#define DS1307_ALARM_CATCH_UP (7 * 86400UL)  // s, older missed alarms are not reported
+
+// oscillator drift record in NVRAM, see calibrate()
+#define DS1307_DRIFT_ADDRESS 43              // NVRAM 43..52: format, crc, drift, calibration time, applied seconds
+#define DS1307_DRIFT_FORMAT 0xd1             // version byte of the drift record
+#define DS1307_DRIFT_RECORD_SIZE 10
+#define DS1307_DRIFT_NO_EPOCH 0xffffffffUL   // no calibration stored
+#define DS1307_DRIFT_MIN_INTERVAL 86400UL    // s between calibrations needed for a new drift estimate
+#define DS1307_DRIFT_LIMIT 20000             // 0.01 ppm, a larger error means the clock was wrong, not drifting
+#define DS1307_DRIFT_ADJUST_WINDOW 50        // ms, DS1307_DRIFT_AUTO_SET sets the chip if a read sees the tick this soon
+// modes of setDriftCompensation()
+#define DS1307_DRIFT_OFF 0                   // return the chip time as it is
+#define DS1307_DRIFT_CORRECT 1               // correct the time read from the chip
+#define DS1307_DRIFT_AUTO_SET 2              // also set the chip once the correction reaches a second
+
+#define DS1307_SOFT_CLOCK_TIMEOUT 1500       // ms without SQW edge after which the software clock resyncs
+#define DS1307_SQW_PERIOD_MIN 900000UL       // us, SQW periods outside MIN..MAX (missed edges) are not measured
+#define DS1307_SQW_PERIOD_MAX 1100000UL
+#define DS1307_FAST_POLL_MAX_GAP 30000UL     // ms between getTime() calls after which all registers are read again
+#define DS1307_I2C_TIMEOUT 25                // ms a transfer may take before it is given up
+#define DS1307_SNAPSHOT_RAM 4                // NVRAM bytes read by snapshot(): time-set token and alarm table header
+
+// states of the asynchronous transfer, see poll()
+#define DS1307_ASYNC_IDLE 0
+#define DS1307_ASYNC_POINTER 1               // register pointer has to be written
+#define DS1307_ASYNC_REQUEST 2               // data has to be requested
+#define DS1307_ASYNC_RECEIVE 3               // waiting for the data
+#define DS1307_ASYNC_READY 4                 // data has arrived
+#define DS1307_ASYNC_ERROR 5                 // no answer or timeout
+
+// *********************************************
+// Daylight saving time rules
+// *********************************************
+// switch at "hour" (local time in effect before the switch) on the
+// week-th (1..4, 5 = last) day of week dow (0 = sunday) of month
+struct DS1307newDSTRule
+{
+  uint8_t month;                        // 1..12, 0 = no daylight saving time
+  uint8_t week;
+  uint8_t dow;
+  uint8_t hour;
+};
+
+struct DS1307newTimeZone
+{
+  int16_t stdOffset;                    // minutes east of UTC during standard time
+  int16_t dstOffset;                    // minutes east of UTC during daylight saving time
+  DS1307newDSTRule dstStart;
+  DS1307newDSTRule dstEnd;
+};
+
+extern const DS1307newTimeZone DS1307_TZ_WET;         // Western Europe (UK, PT)
+extern const DS1307newTimeZone DS1307_TZ_CET;         // Central Europe
+extern const DS1307newTimeZone DS1307_TZ_EET;         // Eastern Europe
+extern const DS1307newTimeZone DS1307_TZ_US_EASTERN;
+extern const DS1307newTimeZone DS1307_TZ_US_CENTRAL;
+extern const DS1307newTimeZone DS1307_TZ_US_MOUNTAIN;
+extern const DS1307newTimeZone DS1307_TZ_US_PACIFIC;
+
+// *********************************************
+// Arrays of broken down times
+// *********************************************
+// one array per field, element i of all arrays belongs to the same time,
+// see DS1307new::decodeTime2000Array()
+struct DS1307newTimeArrays
+{
+  uint16_t *year;
+  uint8_t *month;                       // 1..12
+  uint8_t *day;                         // 1..31
+  uint8_t *hour;
+  uint8_t *minute;
+  uint8_t *second;
+  uint8_t *dow;                         // 0 = sunday, not used by encodeTime2000Array()
+};
+
+// *********************************************
+// Consistent copy of the time
+// *********************************************
+// the time fields of an object as published by DS1307new::publishTime(),
+// see DS1307new::readConsistent()
+struct DS1307newTime
+{
+  uint32_t time2000;
+  uint16_t year;
+  uint8_t month;
+  uint8_t day;
+  uint8_t hour;
+  uint8_t minute;
+  uint8_t second;
+  uint8_t dow;
+};
+
+#if defined(__AVR__)
+typedef uint8_t DS1307newSequence;      // read with one instruction, an interrupt cannot split it
+#else
+typedef uint32_t DS1307newSequence;
+#endif
+
 // *********************************************
 // Library interface description
 // *********************************************
 class DS1307new
 {
   public:
-    DS1307new();
+    DS1307new(TwoWire &bus = Wire, uint8_t address = DS1307_ID);
     // new additions to library for handling alarms
     boolean isTimeSet();
     boolean clearAlarm( uint8_t dayOfWeek);
     boolean setAlarm( uint8_t dayOfWeek, uint8_t alarmHour, uint8_t alarmMinutes);
     void setAlarm( uint8_t dayOfWeek, uint8_t alarmCode);
+    boolean addAlarm( uint8_t alarmHour, uint8_t alarmMinutes, uint8_t weekdayMask, boolean oneShot = false);
+    boolean removeAlarm( uint8_t index);
+    uint8_t getAlarmCount();
+    boolean getAlarm( uint8_t index, uint8_t *alarmHour, uint8_t *alarmMinutes, uint8_t *weekdayMask, boolean *oneShot);
     boolean isAlarmTime();
+    boolean isAlarmMissed();
+    uint32_t getAlarmTime2000();
+    uint32_t nextAlarmTime2000();
+    uint32_t secondsUntilNextAlarm();
     void setDateTimeRTC();
     void setDateTime (const char* date, const char* time);
     void clearAlarmNvramMemory();
     void listNvramMemory();
     void printTime();
     void print2Decimals( uint8_t number);
+    // text output into a buffer of the caller, see formatTime()
+    uint8_t formatTime(char *buffer, uint8_t size, const char *layout);
+    uint8_t formatISO8601(char *buffer, uint8_t size);
+    // optional RAM mirror of the NVRAM, see enableNvramCache()
+    boolean enableNvramCache(uint16_t autoFlushMillis = DS1307_NVRAM_WRITE_THROUGH);
+    void disableNvramCache(void);
+    void sync(void);
+    void beginNvramBatch(void);
+    void commit(void);
+    // software clock driven by the 1 Hz SQW/OUT signal, see enableSoftwareClock()
+    void enableSoftwareClock(uint8_t interruptPin, uint8_t resyncMinutes);
+    void disableSoftwareClock(void);
+    uint16_t getTimeMillis(void);
+    // oscillator drift estimation and compensation, see calibrate()
+    boolean calibrate(uint32_t referenceTime2000);
+    void setDriftCompensation(uint8_t mode);
+    int16_t getDrift(void);
+    // read only the seconds register in getTime(), see enableFastPoll()
+    void enableFastPoll(void);
+    void disableFastPoll(void);
+    // asynchronous reads, see poll()
+    boolean beginGetTime(void);
+    boolean beginGetRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity);
+    uint8_t poll(void);
+    boolean isReady(void);
+    boolean isBusy(void);
+    // copy of the time for another context (interrupt, thread), see readConsistent()
+    void publishTime(void);
+    boolean readConsistent(DS1307newTime &t);
+    // register level access for DS1307newScheduler, see getRegisters()
+    boolean getRegisters(uint8_t rtc_reg, uint8_t * buffer, uint8_t rtc_quantity);
+    boolean isRamHeld(uint8_t rtc_addr);
+    void fillByRegisters(const uint8_t *regs);
+    uint8_t getWriteCount(void);
     
     // initial DS1307 new library functions
     uint8_t isPresent(void);
@@ -53,6 +217,7 @@ class DS1307new
     void stopClock(void);
     void setTime(void);
     void getTime(void);
+    boolean snapshot(void);
     void getCTRL(void);
     void setCTRL(void);
     void getRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity);
@@ -75,32 +240,168 @@ class DS1307new
     void fillByTime2000(uint32_t _time2000);
     void fillByHMS(uint8_t h, uint8_t m, uint8_t s);
     void fillByYMD(uint16_t y, uint8_t m, uint8_t d);
+    // Unix time (seconds after 1970-01-01 00:00), see time2000ToUnix()
+    void fillByUnixTime(int64_t t);
+    int64_t unixTime(void);
+    static int64_t time2000ToUnix(uint32_t _time2000);
+    static uint32_t time2000ToUnix32(uint32_t _time2000);
+    static uint32_t unixToTime2000(int64_t t);
+    // move the time forward, all fields are updated with carries instead of a full recalculation
+    void tick(void);
+    void addSeconds(int32_t s);
+    void addMinutes(int32_t m);
+    void addDays(int32_t d);
+    // convert many times at once, e.g. logged time stamps
+    static void decodeTime2000Array(const uint32_t *t, const DS1307newTimeArrays &out, size_t n);
+    static void encodeTime2000Array(const DS1307newTimeArrays &in, uint32_t *t, size_t n);
     uint8_t isCETSummerTime(void);
 
+    // daylight saving time, the RTC is expected to run in standard (winter) time
+    void setTimeZone(const DS1307newTimeZone &tz);
+    boolean setTimeZone(const char *posixTZ);
+    uint8_t isDST(void);
+    uint8_t isDST(uint32_t _time2000);
+    uint32_t localTime2000(void);
+    uint32_t localTime2000(uint32_t _time2000);
+    int16_t utcOffset(uint32_t _time2000);
+
   private:
+    // I2C bus, started by the first transfer
+    TwoWire *wireBus;
+    uint8_t deviceAddress;
+    boolean wireStarted;
+    TwoWire &wire(void);
     // new additions to DS1307new library fro alarm handling
     uint8_t aspectIsSetToken;          // token used to flag that a certain aspect like time or alarms is set
     uint8_t aspectIsNotSetToken;       // token used to flag that a certain aspect like time or alarms is not set
     uint8_t timeIsSetAddress;       // first address of NVRAM is for time-is-set token
-    uint8_t alarmBitsAddress;       // third address contains bits that flag the days of the week with an alarm set
-    uint8_t alarmCodeAddressOffset; // offset where alarm codes are stored
+    uint8_t alarmBitsAddress;       // old layout: second address contains bits that flag the days of the week with an alarm set
+    uint8_t alarmCodeAddressOffset; // old layout: offset where alarm codes are stored
     uint8_t aspectIsSetTokenHolder;       // placeholder for the read token
     uint8_t zero;                         // zero variable to point to to pass zero to RTC
-    long alarmTriggeredTime;              // last time the alarm was triggered
+    uint32_t alarmLastFired;              // time2000 of the last alarm reported by isAlarmTime()
+    boolean alarmStateLoaded;             // alarmLastFired has been read from NVRAM
+    boolean alarmMissed;                  // the last reported alarm was late
+    uint32_t nextAlarm;                   // cached result of nextAlarmTime2000()
+    uint32_t nextAlarmFrom;               // time2000 the cached result was calculated for
+    boolean nextAlarmValid;               // false after the alarm schedule has changed
+    uint8_t loadAlarms(uint8_t *table);
+    void storeAlarms(uint8_t *table, uint8_t n);
+    boolean insertAlarm(uint8_t *table, uint8_t *n, uint16_t mod, uint8_t mask);
+    void deleteAlarm(uint8_t *table, uint8_t *n, uint8_t index);
+    void removeWeekday(uint8_t *table, uint8_t *n, uint8_t weekdayMask);
+    void loadAlarmState(void);
+    void storeAlarmState(uint32_t t);
+    uint32_t pendingAlarmFrom(void);
+    void skipPastAlarms(void);
     uint8_t convert2decimal(const char* p);
+    // daylight saving time, transitions of one year are cached
+    DS1307newTimeZone timeZone;
+    uint32_t dstYearBegin;                // time2000 of 1st of Jan of the cached year
+    uint32_t dstYearEnd;                  // time2000 of 1st of Jan of the next year, 0 = cache empty
+    uint32_t dstBegin;                    // switch to daylight saving time in the cached year
+    uint32_t dstEnd;                      // switch back to standard time in the cached year
+    void calculate_dst_cache(uint32_t _time2000);
+    static uint32_t time2000_by_rule(uint16_t y, const DS1307newDSTRule &rule);
+    // software clock
+    static DS1307new *softClockInstance;  // object updated by the SQW interrupt
+    static void softClockISR(void);
+    volatile uint32_t softClockTicks;     // SQW edges since the last read of the clock registers
+    volatile unsigned long softClockEdgeMillis; // millis() of the last edge (or of the last read)
+    volatile uint32_t softClockEdgeMicros; // micros() of the last edge
+    volatile uint32_t softClockPeriodMicros; // measured length of a second, 0 = not known yet
+    uint32_t softClockBase;               // time2000 of the last read of the clock registers
+    uint32_t softClockApplied;            // ticks already added to the object
+    uint16_t softClockResyncSeconds;      // read the clock registers after this many ticks
+    uint8_t softClockInterrupt;
+    boolean softClockEnabled;
+    boolean softClockValid;               // softClockBase can be used
+    void getSoftTime(void);
+    // seconds only reads
+    boolean fastPollEnabled;
+    boolean fastPollValid;                // the object holds the result of the last read
+    unsigned long fastPollMillis;         // millis() of the last read
+    uint32_t fastPollTime2000;            // time2000 after the last read, detects changes by the sketch
+    uint8_t fastPollSecond;               // seconds register of the last read, before drift correction
+    void getFastTime(void);
+    // oscillator drift
+    uint8_t driftMode;
+    int16_t drift;                        // 0.01 ppm, positive: the chip runs fast
+    uint32_t driftEpoch;                  // time2000 of the last calibration
+    int8_t driftApplied;                  // seconds the chip has been set back since then
+    uint32_t driftRangeStart;             // driftCorrection() is driftRangeValue for t in
+    uint32_t driftRangeLength;            // driftRangeStart .. + driftRangeLength - 1
+    int32_t driftRangeValue;
+    void loadDrift(void);
+    void storeDrift(void);
+    void rebaseDrift(void);
+    int32_t driftCorrection(uint32_t t);
+    void correctDrift(boolean adjust);
+    void adjustChip(int32_t correction);
+    void writeTime(uint8_t halt);
+    void readTime(void);
+    void acceptTime(const uint8_t *regs);
+    uint8_t snapshotRam[DS1307_SNAPSHOT_RAM]; // NVRAM 0..3 as read by snapshot()
+    boolean snapshotValid;                // snapshotRam can be used by getRAM()
+    void decodeTime(const uint8_t *regs);
+    boolean readRegisters(uint8_t rtc_reg, uint8_t * buffer, uint8_t rtc_quantity);
+    // asynchronous transfer
+    uint8_t asyncState;
+    uint8_t asyncRegister;                // first register to read
+    uint8_t asyncQuantity;
+    uint8_t asyncReceived;
+    uint8_t *asyncTarget;                 // user buffer, or asyncBuffer for the time
+    uint8_t asyncBuffer[7];
+    unsigned long asyncStart;             // millis() when the transfer was started
+    boolean beginAsync(uint8_t rtc_reg, uint8_t * buffer, uint8_t rtc_quantity);
+    // time published by publishTime(), guarded by a sequence counter
+    volatile DS1307newSequence publishedSequence; // odd while publishTime() writes, 0 = nothing published
+    volatile DS1307newTime published;
+    // NVRAM mirror
+    uint8_t nvram[DS1307_NVRAM_SIZE];     // copy of the NVRAM if nvramCached, else only the dirty bytes are valid
+    boolean nvramCached;                  // reads and writes are served by nvram[]
+    uint8_t nvramDirty[(DS1307_NVRAM_SIZE + 7) / 8];  // one bit per byte not yet written to the chip
+    uint8_t nvramBatchDepth;              // nesting of beginNvramBatch()
+    uint16_t nvramAutoFlushMillis;        // flush policy, see enableNvramCache()
+    unsigned long nvramDirtySince;        // millis() of the first write into a clean mirror
+    void autoFlushNvram(void);
+    boolean isNvramDirty(void);
+    boolean readRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity);
+    void writeRAM(uint8_t rtc_addr, uint8_t * rtc_ram, uint8_t rtc_quantity);
     // existing DS1307new library private parts
-    uint8_t is_leap_year(uint16_t y);
+    static uint8_t is_leap_year(uint16_t y);
     void calculate_ydn(void);			// calculate ydn from year, month & day
     void calculate_cdn(void);			// calculate cdn from year & ydn
+    static uint16_t ydn_by_ymd(uint16_t y, uint8_t m, uint8_t d);
+    static uint16_t cdn_by_year_and_ydn(uint16_t y, uint16_t _ydn);
+    static uint16_t year_by_cdn(uint16_t _cdn, uint16_t *_ydn);
+    uint32_t time2000_by_registers(const uint8_t *regs);
+    void carryMinutes(uint16_t m);
+    void nextDay(void);
+    static uint8_t days_in_month(uint16_t y, uint8_t m);
     void calculate_dow(void);			// calculate dow from ydn
     void calculate_time2000(void);		// calculate time2000 from cdn, hour, minute & second
 
     uint16_t _corrected_year_day_number(void);
+    static void decode_time2000_array(const uint32_t * __restrict__ t, uint16_t * __restrict__ year_out,
+      uint8_t * __restrict__ month_out, uint8_t * __restrict__ day_out, uint8_t * __restrict__ hour_out,
+      uint8_t * __restrict__ minute_out, uint8_t * __restrict__ second_out, uint8_t * __restrict__ dow_out, size_t n);
+    static void encode_time2000_array(const uint16_t * __restrict__ year_in, const uint8_t * __restrict__ month_in,
+      const uint8_t * __restrict__ day_in, const uint8_t * __restrict__ hour_in, const uint8_t * __restrict__ minute_in,
+      const uint8_t * __restrict__ second_in, uint32_t * __restrict__ t, size_t n);
+    static uint16_t corrected_ydn(uint16_t y, uint16_t _ydn);
+    static uint8_t month_by_corrected_ydn(uint16_t c_ydn);
+    static uint8_t day_by_month_and_corrected_ydn(uint8_t m, uint16_t c_ydn);
     void calculate_month_by_year_and_ydn(void);
     void calculate_day_by_month_year_and_ydn(void);
 
     uint8_t dec2bcd(uint8_t num);
     uint8_t bcd2dec(uint8_t num);
+
+    uint8_t chipWrites;                   // transfers that changed the chip, see getWriteCount()
+#ifdef DS1307_KERNEL_BENCH
+    friend class DS1307newKernelBench;    // extras/host/ds1307_kernel_bench.cpp times the private kernels
+#endif
 };
 
 extern DS1307new RTC;
@@ -0,0 +1,78 @@
+// #############################################################################
+// #
+// # Scriptname : DS1307newChrono.h
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # std::chrono clock on top of a DS1307new object, for host builds and
+// # cores with a C++11 standard library (not AVR). The epoch is the Unix
+// # epoch and the conversions are the O(1) ones of DS1307new, e.g.
+// #   DS1307newClock::time_point t = DS1307newClock::now();
+// #   std::time_t tt = DS1307newClock::to_time_t(t);
+// # now() calls getTime(), so it is served by the software clock or the
+// # fast poll mode if the object has one enabled. No time zone is applied,
+// # see DS1307new::time2000ToUnix().
+// #
+// #############################################################################
+#ifndef DS1307newChrono_h
+#define DS1307newChrono_h
+
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <chrono>
+#include <ctime>
+#include "DS1307new.h"
+
+// *********************************************
+// Clock interface description
+// *********************************************
+template <DS1307new &rtc>
+struct DS1307newBasicClock
+{
+  typedef std::chrono::seconds duration;
+  typedef duration::rep rep;
+  typedef duration::period period;
+  typedef std::chrono::time_point<DS1307newBasicClock> time_point;
+  static constexpr bool is_steady = false;  // the clock can be set
+
+  static time_point now()
+  {
+    rtc.getTime();
+    return from_time2000(rtc.time2000);
+  }
+
+  static time_point from_time2000(uint32_t _time2000)
+  {
+    return time_point(duration(DS1307new::time2000ToUnix(_time2000)));
+  }
+
+  static uint32_t to_time2000(time_point t)
+  {
+    return DS1307new::unixToTime2000(t.time_since_epoch().count());
+  }
+
+  static std::time_t to_time_t(time_point t)
+  {
+    return (std::time_t)t.time_since_epoch().count();
+  }
+
+  static time_point from_time_t(std::time_t t)
+  {
+    return time_point(duration(t));
+  }
+
+  // same instant on the system clock, correct if the chip runs in UTC
+  static std::chrono::system_clock::time_point to_sys(time_point t)
+  {
+    return std::chrono::system_clock::from_time_t(to_time_t(t));
+  }
+};
+
+template <DS1307new &rtc>
+constexpr bool DS1307newBasicClock<rtc>::is_steady;
+
+typedef DS1307newBasicClock<RTC> DS1307newClock;
+
+#endif
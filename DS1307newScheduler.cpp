@@ -0,0 +1,220 @@
+// #############################################################################
+// #
+// # Scriptname : DS1307newScheduler.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Read scheduler for several clients of one DS1307new object. In a loop
+// # like
+// #   sched.requestTime();                   // logger
+// #   sched.requestRAM(0, logState, 8);      // logger
+// #   sched.requestRegisters(0x07, &ctrl, 1); // user interface
+// #   sched.requestTime();                   // user interface
+// #   sched.service();
+// # the requests are merged into one burst over registers 0x00 - 0x0F
+// # instead of four transfers. Ranges that overlap, touch, or leave a gap
+// # of at most DS1307_READ_MERGE_GAP registers share a burst, every
+// # register is read at most once per service(). With a freshness window
+// # registers read by an earlier service() are reused for that many ms.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <Wire.h>
+#include "DS1307newScheduler.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#if defined(BUFFER_LENGTH) && BUFFER_LENGTH < DS1307_REGISTER_COUNT
+#define DS1307_READ_CHUNK BUFFER_LENGTH      // bytes per read, the Wire receive buffer
+#else
+#define DS1307_READ_CHUNK 32
+#endif
+
+// *********************************************
+// Public functions
+// *********************************************
+DS1307newScheduler::DS1307newScheduler(DS1307new &_rtc, uint16_t freshnessMillis)
+{
+  rtc = &_rtc;
+  pending = 0;
+  freshness = freshnessMillis;
+  memset(cacheValid, 0, sizeof(cacheValid));
+  cacheUsed = false;
+  cacheMillis = 0;
+  cacheWrites = 0;
+}
+
+/*
+  Prototype:
+    boolean requestRegisters(uint8_t rtc_reg, uint8_t *buffer, uint8_t quantity)
+    boolean requestRAM(uint8_t rtc_addr, uint8_t *buffer, uint8_t quantity)
+    boolean requestTime(void)
+  Description:
+    Queue a read for the next service(). requestRegisters() takes chip
+    register addresses (0x00 - 0x3F), requestRAM() NVRAM addresses like
+    getRAM() (0 = register 0x08). buffer must stay valid until
+    service() has returned. requestTime() updates the DS1307new object
+    like snapshot(): the clock registers are taken without the software
+    clock or the fast poll mode, the time is then published for
+    readConsistent().
+  Result:
+    false if the queue is full or the range ends beyond register 0x3F
+*/
+boolean DS1307newScheduler::requestRegisters(uint8_t rtc_reg, uint8_t *buffer, uint8_t quantity)
+{
+  if ( pending >= DS1307_SCHEDULER_QUEUE || quantity == 0 || rtc_reg + quantity > DS1307_REGISTER_COUNT )
+    return false;
+  queue[pending].reg = rtc_reg;
+  queue[pending].quantity = quantity;
+  queue[pending].buffer = buffer;
+  pending++;
+  return true;
+}
+
+boolean DS1307newScheduler::requestRAM(uint8_t rtc_addr, uint8_t *buffer, uint8_t quantity)
+{
+  if ( rtc_addr + quantity > DS1307_NVRAM_SIZE )
+    return false;
+  return requestRegisters(rtc_addr + 8, buffer, quantity);
+}
+
+boolean DS1307newScheduler::requestTime(void)
+{
+  return requestRegisters(0x00, 0, 7);
+}
+
+/*
+  Prototype:
+    uint8_t service(void)
+  Description:
+    Serve all queued requests: registers that are neither in the cache
+    (see setFreshness()) nor NVRAM bytes the object holds (the RAM mirror
+    of enableNvramCache() or the writes of an open beginNvramBatch(), see
+    isRamHeld()) are collected, neighbouring ranges are joined and each
+    joined range is read with one burst (split at the size of the Wire
+    buffer). Then the bytes are copied into the buffers of the requests,
+    the NVRAM bytes the object holds from the object. The queue is empty
+    afterwards.
+  Result:
+    number of requests that could not be served because the chip did not
+    answer, their buffers are unchanged
+*/
+uint8_t DS1307newScheduler::service(void)
+{
+  uint8_t want[DS1307_REGISTER_COUNT / 8];
+  uint8_t failed = 0;
+  uint8_t i, r;
+
+  if ( cacheUsed && (millis() - cacheMillis >= freshness || rtc->getWriteCount() != cacheWrites) )
+    invalidate();                       // too old, or the object has written to the chip
+  memset(want, 0, sizeof(want));
+  for( i = 0; i < pending; i++ )
+    for( r = queue[i].reg; r < queue[i].reg + queue[i].quantity; r++ )
+      if ( !isHeld(r) && !isCached(r) )
+        want[r >> 3] |= 1 << (r & 7);
+  readBursts(want);
+
+  for( i = 0; i < pending; i++ )
+  {
+    const request &q = queue[i];
+    for( r = q.reg; r < q.reg + q.quantity; r++ )
+      if ( !isHeld(r) && !isCached(r) )
+        break;
+    if ( r < q.reg + q.quantity )
+    {
+      failed++;
+      continue;
+    }
+    if ( q.buffer == 0 )
+    {
+      rtc->fillByRegisters(cache);
+      continue;
+    }
+    for( r = 0; r < q.quantity; r++ )
+    {
+      if ( isHeld(q.reg + r) )
+        rtc->getRAM(q.reg + r - 8, q.buffer + r, 1);  // no bus access for held bytes
+      else
+        q.buffer[r] = cache[q.reg + r];
+    }
+  }
+  pending = 0;
+  return failed;
+}
+
+uint8_t DS1307newScheduler::getPending(void)
+{
+  return pending;
+}
+
+/*
+  Registers read by a service() are reused by later calls of service()
+  within freshnessMillis ms (0: not at all). The clock registers are
+  then up to freshnessMillis old. All registers are read again after the
+  DS1307new object has written to the chip (setTime(), setRAM(),
+  setCTRL(), ...); writes through another object or bus are not seen,
+  invalidate() drops the cache.
+*/
+void DS1307newScheduler::setFreshness(uint16_t freshnessMillis)
+{
+  freshness = freshnessMillis;
+}
+
+void DS1307newScheduler::invalidate(void)
+{
+  memset(cacheValid, 0, sizeof(cacheValid));
+  cacheUsed = false;
+}
+
+// *********************************************
+// Private functions
+// *********************************************
+boolean DS1307newScheduler::isCached(uint8_t reg)
+{
+  return (cacheValid[reg >> 3] >> (reg & 7)) & 1;
+}
+
+// NVRAM the object has newer values of than the chip: the RAM mirror, or the writes of an open batch
+boolean DS1307newScheduler::isHeld(uint8_t reg)
+{
+  return reg >= 8 && rtc->isRamHeld(reg - 8);
+}
+
+// read the wanted registers, a gap of up to DS1307_READ_MERGE_GAP registers is read along
+void DS1307newScheduler::readBursts(const uint8_t *want)
+{
+  uint8_t r = 0;
+  while( r < DS1307_REGISTER_COUNT )
+  {
+    if ( ((want[r >> 3] >> (r & 7)) & 1) == 0 )
+    {
+      r++;
+      continue;
+    }
+    uint8_t first = r;
+    uint8_t end = r + 1;                // one past the last wanted register of the burst
+    for( r = end; r < DS1307_REGISTER_COUNT && r <= end + DS1307_READ_MERGE_GAP; r++ )
+      if ( (want[r >> 3] >> (r & 7)) & 1 )
+        end = r + 1;
+    for( r = first; r < end; )
+    {
+      uint8_t n = end - r > DS1307_READ_CHUNK ? DS1307_READ_CHUNK : end - r;
+      if ( !rtc->getRegisters(r, cache + r, n) )
+        return;                         // the chip does not answer, the rest would fail as well
+      if ( !cacheUsed )
+      {
+        cacheUsed = true;
+        cacheMillis = millis();
+        cacheWrites = rtc->getWriteCount();
+      }
+      for( uint8_t k = r; k < r + n; k++ )
+        cacheValid[k >> 3] |= 1 << (k & 7);
+      r += n;
+    }
+    r = end;
+  }
+}
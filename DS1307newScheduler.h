@@ -0,0 +1,67 @@
+// #############################################################################
+// #
+// # Scriptname : DS1307newScheduler.h
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Read scheduler for several clients of one DS1307new object: the
+// # clients queue the registers or NVRAM bytes they need, service() reads
+// # them with as few bursts as possible and copies the bytes into the
+// # buffers of the clients.
+// #
+// #############################################################################
+#ifndef DS1307newScheduler_h
+#define DS1307newScheduler_h
+
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "DS1307new.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define DS1307_SCHEDULER_QUEUE 8             // requests per service()
+#define DS1307_SCHEDULER_FRESHNESS 0         // ms a register read may be reused, 0 = only within one service()
+#define DS1307_READ_MERGE_GAP 3              // bytes nobody requested a burst may read to save a transfer
+#define DS1307_REGISTER_COUNT 64             // clock, control and NVRAM registers 0x00 - 0x3F
+
+// *********************************************
+// Library interface description
+// *********************************************
+class DS1307newScheduler
+{
+  public:
+    DS1307newScheduler(DS1307new &rtc = RTC, uint16_t freshnessMillis = DS1307_SCHEDULER_FRESHNESS);
+    boolean requestRegisters(uint8_t rtc_reg, uint8_t *buffer, uint8_t quantity);
+    boolean requestRAM(uint8_t rtc_addr, uint8_t *buffer, uint8_t quantity);
+    boolean requestTime(void);
+    uint8_t service(void);
+    uint8_t getPending(void);
+    void setFreshness(uint16_t freshnessMillis);
+    void invalidate(void);
+
+  private:
+    struct request
+    {
+      uint8_t reg;                      // first register
+      uint8_t quantity;
+      uint8_t *buffer;                  // 0: the clock registers for the DS1307new object
+    };
+    DS1307new *rtc;
+    request queue[DS1307_SCHEDULER_QUEUE];
+    uint8_t pending;                    // requests in queue
+    uint16_t freshness;
+    // registers read by earlier bursts
+    uint8_t cache[DS1307_REGISTER_COUNT];
+    uint8_t cacheValid[DS1307_REGISTER_COUNT / 8];  // one bit per register
+    boolean cacheUsed;                  // a bit in cacheValid is set
+    unsigned long cacheMillis;          // millis() of the oldest register in cache
+    uint8_t cacheWrites;                // writes of the object to the chip when the cache was started
+    boolean isCached(uint8_t reg);
+    boolean isHeld(uint8_t reg);
+    void readBursts(const uint8_t *want);
+};
+
+#endif
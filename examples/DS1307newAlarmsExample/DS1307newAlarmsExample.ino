@@ -9,7 +9,7 @@
  * - how to get the current time of the DS1307 chip and if not set yet it will set the time
  * - it shows various example how to set alarms
  * - in the loop part it shows how to check if there is an alarm that neds to go off.
- * - note: weekday alarms can only be set at 5 minute resulution, e.g. 8:10 is OK and 8:09 is not
+ * - note: up to 13 alarms can be stored, each for one or more weekdays at minute resolution
  *
  * Circuit:
  * - see here for a nice istructable that shows how to connect the DS1307 to an Arduino
@@ -56,13 +56,16 @@ void setup() {
     RTC.setDateTimeRTC();
   }
   
-  //examples how to set alarms [alarms are defined at at 5 minute resolution]
+  // keep a copy of the NVRAM in RAM, so that isAlarmTime() in the loop does not need to read the alarms over I2C
+  RTC.enableNvramCache();
+
+  //examples how to set alarms [alarms are defined at minute resolution]
   RTC.clearAlarmNvramMemory(); // clears the DS1307 internal NVRAM to hold the alarms
   RTC.listNvramMemory(); // print out the NVRAM memory values
   // set alarm Mondays at 5:25, 
   // first parameter is day of the week (sunday = 0, monday = 1, ..., saturday = 6)
   // second parameter is the hour in 24h style
-  // last parameter is the minutes in 5 minute resolution, i.e. 0, 5, 10, 15, 20, 25, 30, 35, 40, 45, 50, 55
+  // last parameter is the minutes (0..59)
   RTC.setAlarm( 1, 5, 25);   
   RTC.listNvramMemory();
   RTC.setAlarm( 2, 16, 35); // set alarm Tuesdays at 16:05
@@ -75,6 +78,10 @@ void setup() {
   RTC.listNvramMemory();
   RTC.setAlarm ( 6, 20, 0); // set alarm Saturdays at 20:00
   RTC.listNvramMemory();
+  // alarm on several days: weekday mask with bit 0 = sunday ... bit 6 = saturday
+  RTC.addAlarm( 7, 45, 0x3e);             // monday to friday at 7:45
+  RTC.addAlarm( 12, 2, DS1307_EVERY_DAY, true); // once, at the next 12:02
+  RTC.listNvramMemory();
 
   #ifdef DEBUG
     Serial.println("DS1307 time and alarm memory module");
@@ -91,15 +98,20 @@ void setup() {
  * main loop of the sketch
  */
 void loop() {
-  RTC.getTime(); // get current time from the DS1307 RTC chip
+  RTC.snapshot(); // time, control register and alarm table header from the DS1307 RTC chip in one read
   RTC.printTime(); // print it to serial
-  // check if alarms need to be triggered
-  if (RTC.isAlarmTime()) {
+  // check if alarms need to be triggered, alarms missed during a power loss are reported one by one
+  while (RTC.isAlarmTime()) {
     #ifdef DEBUG
-      Serial.println("Alarm time has passed!");
+      Serial.println(RTC.isAlarmMissed() ? "Alarm was missed!" : "Alarm time has passed!");
     #endif
   }
-  delay(10000); // wait 10 seconds
+  // sleep until the next alarm instead of polling, but print the time at least every 10 seconds
+  uint32_t secondsToWait = RTC.secondsUntilNextAlarm();
+  if (secondsToWait > 10) {
+    secondsToWait = 10;
+  }
+  delay(secondsToWait * 1000UL); // the next getTime() verifies that the alarm time has come
 }
 
 
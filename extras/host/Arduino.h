@@ -0,0 +1,115 @@
+// #############################################################################
+// #
+// # Scriptname : Arduino.h
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Minimal host (Linux) stand-in for the Arduino core so that the DS1307new
+// # library compiles unmodified on a PC. Time is virtual: it only advances
+// # through delay(), through modelled I2C bus time and through hostAdvance()
+// # (ArduinoHost.cpp). The build for a Linux board links ArduinoHostDevice.cpp
+// # instead, there time is the monotonic clock of the system.
+// # ds1307_avr_bench.cpp uses the same headers for an AVR build under simavr.
+// #
+// #############################################################################
+#ifndef Arduino_h
+#define Arduino_h
+
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+
+// *********************************************
+// DEFINE
+// *********************************************
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#ifdef __AVR__
+// cycle counts under simavr (make avr-bench): real flash tables and interrupts
+#include <avr/pgmspace.h>
+#include <avr/interrupt.h>
+#define F(s) (s)
+#else
+#define PROGMEM
+#define PSTR(s) (s)
+#define F(s) (s)
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uint16_t *)(addr))
+#endif
+
+#define INPUT 0x0
+#define OUTPUT 0x1
+#define INPUT_PULLUP 0x2
+
+#define CHANGE 1
+#define FALLING 2
+#define RISING 3
+
+#define digitalPinToInterrupt(p) (p)
+#ifdef __AVR__
+#define noInterrupts() cli()
+#define interrupts() sei()
+#else
+#define noInterrupts()
+#define interrupts()
+#endif
+
+// *********************************************
+// Time (virtual in the simulated builds, see above)
+// *********************************************
+unsigned long millis(void);
+unsigned long micros(void);
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+void hostAdvance(uint32_t us);        // advance virtual time, runs the simulated devices (no effect on a board)
+
+// *********************************************
+// Pins and interrupts (driven by the simulated devices)
+// *********************************************
+void pinMode(uint8_t pin, uint8_t mode);
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode);
+void detachInterrupt(uint8_t interruptNum);
+void hostRaiseInterrupt(uint8_t interruptNum, int edge, uint32_t usIntoStep); // usIntoStep: time of the edge within the current hostAdvance()
+
+// *********************************************
+// Serial (writes to stdout)
+// *********************************************
+class HardwareSerial
+{
+  public:
+    void begin(unsigned long baud);
+    operator bool() { return true; }
+    size_t write(uint8_t c);
+    size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str);
+    size_t print(const char *str);
+    size_t print(char c);
+    size_t print(unsigned long n, int base = DEC);
+    size_t print(long n, int base = DEC);
+    size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t print(int n, int base = DEC) { return print((long)n, base); }
+    size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+    size_t println(void);
+    size_t println(const char *str);
+    size_t println(char c);
+    size_t println(unsigned long n, int base = DEC);
+    size_t println(long n, int base = DEC);
+    size_t println(unsigned int n, int base = DEC) { return println((unsigned long)n, base); }
+    size_t println(int n, int base = DEC) { return println((long)n, base); }
+    size_t println(unsigned char n, int base = DEC) { return println((unsigned long)n, base); }
+};
+
+extern HardwareSerial Serial;
+
+#endif
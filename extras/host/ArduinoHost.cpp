@@ -0,0 +1,93 @@
+// #############################################################################
+// #
+// # Scriptname : ArduinoHost.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Virtual time and interrupts of the simulated builds: time advances
+// # only through delay(), the modelled I2C bus time and hostAdvance(), the
+// # simulated devices raise the interrupts. ArduinoHostDevice.cpp is the
+// # wall-clock counterpart for a Linux board.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Arduino.h"
+#include "Wire.h"
+
+// *********************************************
+// Virtual time
+// *********************************************
+static uint64_t host_micros = 0;
+static uint64_t host_step_start = 0;    // host_micros when the running hostAdvance() began
+
+unsigned long millis(void)
+{
+  return (unsigned long)(uint32_t)(host_micros / 1000);
+}
+
+unsigned long micros(void)
+{
+  return (unsigned long)(uint32_t)host_micros;
+}
+
+void hostAdvance(uint32_t us)
+{
+  uint64_t end = host_micros + us;
+  host_step_start = host_micros;
+  Wire.advance(us);
+  host_micros = end;
+}
+
+void delay(unsigned long ms)
+{
+  while( ms > 1000 )                    // keep the steps small enough for edge driven models
+  {
+    hostAdvance(1000000UL);
+    ms -= 1000;
+  }
+  hostAdvance(ms * 1000UL);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  hostAdvance(us);
+}
+
+// *********************************************
+// Pins and interrupts
+// *********************************************
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  (void)pin;
+  (void)mode;
+}
+
+static void (*host_isr[8])(void);
+static int host_isr_mode[8];
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode)
+{
+  if ( interruptNum >= 8 )
+    return;
+  host_isr[interruptNum] = userFunc;
+  host_isr_mode[interruptNum] = mode;
+}
+
+void detachInterrupt(uint8_t interruptNum)
+{
+  if ( interruptNum >= 8 )
+    return;
+  host_isr[interruptNum] = 0;
+}
+
+void hostRaiseInterrupt(uint8_t interruptNum, int edge, uint32_t usIntoStep)
+{
+  if ( interruptNum >= 8 || host_isr[interruptNum] == 0 )
+    return;
+  host_micros = host_step_start + usIntoStep;  // micros() in the ISR is the time of the edge
+  if ( host_isr_mode[interruptNum] == CHANGE || host_isr_mode[interruptNum] == edge )
+    host_isr[interruptNum]();
+}
@@ -0,0 +1,108 @@
+// #############################################################################
+// #
+// # Scriptname : ArduinoHostDevice.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Time and interrupts of the builds for a Linux board: millis() and
+// # micros() run on CLOCK_MONOTONIC from the first call on, delay() and
+// # delayMicroseconds() sleep. The I2C transfers take their real time in
+// # the kernel, so hostAdvance() has nothing to model and returns at once.
+// # ArduinoHost.cpp is the virtual time counterpart of the simulated builds.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <errno.h>
+#include <time.h>
+#include "Arduino.h"
+
+// *********************************************
+// Wall-clock time
+// *********************************************
+static uint64_t host_monotonic_micros(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+// microseconds since the first call, like the time since reset of a board
+static uint64_t host_elapsed_micros(void)
+{
+  static uint64_t origin = host_monotonic_micros();
+  return host_monotonic_micros() - origin;
+}
+
+static void host_sleep(uint64_t us)
+{
+  struct timespec t, rest;
+  t.tv_sec = us / 1000000ULL;
+  t.tv_nsec = (us % 1000000ULL) * 1000;
+  while( nanosleep(&t, &rest) != 0 && errno == EINTR )
+    t = rest;                           // a signal ended the sleep early
+}
+
+unsigned long millis(void)
+{
+  return (unsigned long)(uint32_t)(host_elapsed_micros() / 1000);
+}
+
+unsigned long micros(void)
+{
+  return (unsigned long)(uint32_t)host_elapsed_micros();
+}
+
+void hostAdvance(uint32_t us)
+{
+  (void)us;
+}
+
+void delay(unsigned long ms)
+{
+  host_sleep((uint64_t)ms * 1000);
+}
+
+void delayMicroseconds(unsigned int us)
+{
+  host_sleep(us);
+}
+
+// *********************************************
+// Pins and interrupts
+// *********************************************
+void pinMode(uint8_t pin, uint8_t mode)
+{
+  (void)pin;
+  (void)mode;
+}
+
+static void (*host_isr[8])(void);
+static int host_isr_mode[8];
+
+void attachInterrupt(uint8_t interruptNum, void (*userFunc)(void), int mode)
+{
+  if ( interruptNum >= 8 )
+    return;
+  host_isr[interruptNum] = userFunc;
+  host_isr_mode[interruptNum] = mode;
+}
+
+void detachInterrupt(uint8_t interruptNum)
+{
+  if ( interruptNum >= 8 )
+    return;
+  host_isr[interruptNum] = 0;
+}
+
+// for a GPIO edge seen by the sketch, the edge happens now
+void hostRaiseInterrupt(uint8_t interruptNum, int edge, uint32_t usIntoStep)
+{
+  (void)usIntoStep;
+  if ( interruptNum >= 8 || host_isr[interruptNum] == 0 )
+    return;
+  if ( host_isr_mode[interruptNum] == CHANGE || host_isr_mode[interruptNum] == edge )
+    host_isr[interruptNum]();
+}
@@ -0,0 +1,205 @@
+// #############################################################################
+// #
+// # Scriptname : DS1307Sim.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Register level model of the DS1307 for host builds.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "DS1307Sim.h"
+
+// *********************************************
+// Private helpers
+// *********************************************
+static uint8_t sim_bcd2dec(uint8_t num)
+{
+  return (num >> 4) * 10 + (num & 0x0f);
+}
+
+static uint8_t sim_dec2bcd(uint8_t num)
+{
+  return ((num / 10) << 4) | (num % 10);
+}
+
+// the chip only knows the 4 year rule, which is right for 2000 - 2099
+static uint8_t sim_days_in_month(uint8_t month, uint8_t year)
+{
+  static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  if ( month == 2 && (year & 3) == 0 )
+    return 29;
+  return days[month - 1];
+}
+
+// host time of a position within a step given in crystal time, at most the end of the step
+static uint32_t sim_host_position(uint32_t done, uint32_t crystal, uint32_t hostUs)
+{
+  if ( crystal == hostUs )
+    return done;
+  return (uint64_t)done * hostUs / crystal;
+}
+
+// *********************************************
+// Public functions
+// *********************************************
+DS1307Sim::DS1307Sim(uint8_t _address)
+{
+  address = _address;
+  sqwInterrupt = -1;
+  sqwEdges = 0;
+  drift = 0;
+  driftRemainder = 0;
+  reset();
+}
+
+void DS1307Sim::reset(void)
+{
+  memset(reg, 0xff, sizeof(reg));
+  reg[0] = 0x80;                        // CH set: oscillator halted
+  reg[1] = 0x00;
+  reg[2] = 0x00;
+  reg[3] = 0x01;                        // dow 1..7
+  reg[4] = 0x01;
+  reg[5] = 0x01;
+  reg[6] = 0x00;
+  reg[7] = 0x03;                        // OUT=0, SQWE=0, RS=11
+  pointer = 0;
+  subSecondMicros = 0;
+}
+
+void DS1307Sim::busWrite(const uint8_t *data, uint8_t quantity)
+{
+  if ( quantity == 0 )
+    return;
+  pointer = data[0] & 0x3f;
+  for( uint8_t i = 1; i < quantity; i++ )
+  {
+    if ( pointer == 0 )
+      subSecondMicros = 0;              // writing the seconds register resets the countdown chain
+    reg[pointer] = data[i];
+    pointer = (pointer + 1) & 0x3f;
+  }
+}
+
+void DS1307Sim::busRead(uint8_t *data, uint8_t quantity)
+{
+  for( uint8_t i = 0; i < quantity; i++ )
+  {
+    data[i] = reg[pointer];
+    pointer = (pointer + 1) & 0x3f;
+  }
+}
+
+void DS1307Sim::setDateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second)
+{
+  // day of week (1 = sunday as written by DS1307new), Sakamoto's method
+  static const uint8_t t[12] = { 0, 3, 2, 5, 0, 3, 5, 1, 4, 6, 2, 4 };
+  uint16_t y = year - (month < 3);
+  uint8_t dow = (y + y / 4 - y / 100 + y / 400 + t[month - 1] + day) % 7;
+  reg[0] = sim_dec2bcd(second);
+  reg[1] = sim_dec2bcd(minute);
+  reg[2] = sim_dec2bcd(hour);
+  reg[3] = sim_dec2bcd(dow + 1);
+  reg[4] = sim_dec2bcd(day);
+  reg[5] = sim_dec2bcd(month);
+  reg[6] = sim_dec2bcd(year - 2000);
+  subSecondMicros = 0;
+}
+
+void DS1307Sim::advance(uint32_t us)
+{
+  uint32_t hostUs = us;
+  if ( reg[0] & 0x80 )
+    return;                             // oscillator halted
+  if ( drift != 0 )
+  {
+    int64_t extra;
+    driftRemainder += (int64_t)us * drift;
+    extra = driftRemainder / 100000000LL;
+    driftRemainder -= extra * 100000000LL;
+    us = (uint32_t)((int64_t)us + extra);
+  }
+  uint32_t crystal = us;                // crystal time of this step, host time is hostUs
+  uint32_t done = 0;                    // position of the edges within this step, crystal time
+  while( us > 0 )
+  {
+    // step to the next half second, where SQW/OUT toggles
+    uint32_t next = subSecondMicros < 500000UL ? 500000UL : 1000000UL;
+    uint32_t step = next - subSecondMicros;
+    if ( step > us )
+    {
+      subSecondMicros += us;
+      return;
+    }
+    us -= step;
+    done += step;
+    subSecondMicros = next;
+    boolean sqw = (reg[7] & 0x13) == 0x10;   // SQWE and 1 Hz
+    if ( next == 500000UL )
+    {
+      if ( sqw && sqwInterrupt >= 0 )
+        hostRaiseInterrupt(sqwInterrupt, RISING, sim_host_position(done, crystal, hostUs));
+      continue;
+    }
+    subSecondMicros = 0;
+    tickSecond();
+    if ( sqw )
+    {
+      sqwEdges++;
+      if ( sqwInterrupt >= 0 )
+        hostRaiseInterrupt(sqwInterrupt, FALLING, sim_host_position(done, crystal, hostUs));
+    }
+  }
+}
+
+void DS1307Sim::tickSecond(void)
+{
+  uint8_t second = sim_bcd2dec(reg[0] & 0x7f);
+  uint8_t minute = sim_bcd2dec(reg[1]);
+  uint8_t hour = sim_bcd2dec(reg[2] & 0x3f);
+  uint8_t dow = sim_bcd2dec(reg[3]);
+  uint8_t day = sim_bcd2dec(reg[4]);
+  uint8_t month = sim_bcd2dec(reg[5]);
+  uint8_t year = sim_bcd2dec(reg[6]);
+
+  if ( ++second >= 60 )
+  {
+    second = 0;
+    if ( ++minute >= 60 )
+    {
+      minute = 0;
+      if ( ++hour >= 24 )
+      {
+        hour = 0;
+        if ( ++dow > 7 )
+          dow = 1;
+        if ( ++day > sim_days_in_month(month, year) )
+        {
+          day = 1;
+          if ( ++month > 12 )
+          {
+            month = 1;
+            if ( ++year > 99 )
+              year = 0;
+          }
+        }
+      }
+    }
+  }
+  reg[0] = sim_dec2bcd(second);
+  reg[1] = sim_dec2bcd(minute);
+  reg[2] = sim_dec2bcd(hour);
+  reg[3] = sim_dec2bcd(dow);
+  reg[4] = sim_dec2bcd(day);
+  reg[5] = sim_dec2bcd(month);
+  reg[6] = sim_dec2bcd(year);
+}
+
+// *********************************************
+// Define simulated device
+// *********************************************
+DS1307Sim RTCSim;
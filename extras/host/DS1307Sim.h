@@ -0,0 +1,59 @@
+// #############################################################################
+// #
+// # Scriptname : DS1307Sim.h
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Register level model of the DS1307 for host builds:
+// #   0x00 - 0x06  clock registers in BCD (CH bit in 0x00, 24h mode only)
+// #   0x07         control register
+// #   0x08 - 0x3F  56 bytes of NVRAM
+// # The register pointer auto increments and wraps from 0x3F to 0x00 like
+// # the real chip. The oscillator is driven by the virtual host time.
+// # With SQWE set and RS = 00 the SQW/OUT pin toggles at 1 Hz; the falling
+// # edge coincides with the seconds increment and is delivered to the
+// # host interrupt sqwInterrupt.
+// # drift models a crystal that is off by the given amount (0.01 ppm units).
+// #
+// #############################################################################
+#ifndef DS1307Sim_h
+#define DS1307Sim_h
+
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Arduino.h"
+#include "Wire.h"
+
+// *********************************************
+// Library interface description
+// *********************************************
+class DS1307Sim : public TwoWireDevice
+{
+  public:
+    DS1307Sim(uint8_t _address = 0x68);
+    uint8_t reg[64];                    // register map as seen on the bus
+    uint8_t pointer;                    // register address pointer
+    int8_t sqwInterrupt;                // interrupt number SQW/OUT is wired to, -1 = not connected
+    uint32_t sqwEdges;                  // falling edges generated so far
+    int32_t drift;                      // oscillator error in 0.01 ppm, positive runs fast
+
+    // bus side, called by TwoWire
+    void busWrite(const uint8_t *data, uint8_t quantity);
+    void busRead(uint8_t *data, uint8_t quantity);
+
+    // host side
+    void setDateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t minute, uint8_t second);
+    void advance(uint32_t us);          // run the oscillator for us microseconds
+    void reset(void);                   // power on state: clock halted, NVRAM random, here 0xff
+
+  private:
+    uint32_t subSecondMicros;           // position within the current second
+    int64_t driftRemainder;             // fraction of a microsecond not yet applied, in 1e-8 us
+    void tickSecond(void);
+};
+
+extern DS1307Sim RTCSim;                // the device attached to Wire by WireSim.cpp
+
+#endif
@@ -0,0 +1,98 @@
+// #############################################################################
+// #
+// # Scriptname : HardwareSerial.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Serial of the host builds, written to stdout.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <stdio.h>
+#include "Arduino.h"
+
+// *********************************************
+// Serial
+// *********************************************
+void HardwareSerial::begin(unsigned long baud)
+{
+  (void)baud;
+}
+
+size_t HardwareSerial::write(uint8_t c)
+{
+  return fwrite(&c, 1, 1, stdout);
+}
+
+size_t HardwareSerial::write(const uint8_t *buffer, size_t size)
+{
+  return fwrite(buffer, 1, size, stdout);
+}
+
+size_t HardwareSerial::write(const char *str)
+{
+  return fwrite(str, 1, strlen(str), stdout);
+}
+
+size_t HardwareSerial::print(const char *str)
+{
+  return write(str);
+}
+
+size_t HardwareSerial::print(char c)
+{
+  return write((uint8_t)c);
+}
+
+size_t HardwareSerial::print(unsigned long n, int base)
+{
+  char buf[33];
+  char *p = buf + sizeof(buf) - 1;
+  *p = '\0';
+  if ( base < 2 )
+    base = 10;
+  do
+  {
+    uint8_t digit = n % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    n /= base;
+  } while( n != 0 );
+  return write(p);
+}
+
+size_t HardwareSerial::print(long n, int base)
+{
+  if ( n < 0 && base == DEC )
+    return print('-') + print((unsigned long)-n, base);
+  return print((unsigned long)n, base);
+}
+
+size_t HardwareSerial::println(void)
+{
+  return write("\r\n");
+}
+
+size_t HardwareSerial::println(const char *str)
+{
+  return print(str) + println();
+}
+
+size_t HardwareSerial::println(char c)
+{
+  return print(c) + println();
+}
+
+size_t HardwareSerial::println(unsigned long n, int base)
+{
+  return print(n, base) + println();
+}
+
+size_t HardwareSerial::println(long n, int base)
+{
+  return print(n, base) + println();
+}
+
+HardwareSerial Serial;
@@ -0,0 +1,45 @@
+// #############################################################################
+// #
+// # Scriptname : HostCheck.h
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Helpers of the *_check.cpp programs run by "make check": CHECK()
+// # reports a failed condition with its line, checkResult() prints the
+// # summary and gives the exit code (1 if a check failed).
+// #
+// #############################################################################
+#ifndef HostCheck_h
+#define HostCheck_h
+
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <stdio.h>
+
+// *********************************************
+// Checks
+// *********************************************
+static unsigned long checkFailures;
+
+static void checkFailed(const char *file, int line, const char *condition)
+{
+  if ( checkFailures++ < 20 )
+    printf("%s:%d: failed: %s\n", file, line, condition);
+}
+
+#define CHECK(c) do { if ( !(c) ) checkFailed(__FILE__, __LINE__, #c); } while( 0 )
+
+static int checkResult(const char *name)
+{
+  if ( checkFailures != 0 )
+  {
+    printf("%s: %lu failed checks\n", name, checkFailures);
+    return 1;
+  }
+  printf("%s: ok\n", name);
+  return 0;
+}
+
+#endif
@@ -0,0 +1,284 @@
+// #############################################################################
+// #
+// # Scriptname : Wire.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Host (Linux) stand-in for the Arduino TwoWire class, talking to simulated
+// # devices. Return values and buffer limits follow the AVR Wire
+// # library, so truncation and NACK handling behave like on the target.
+// # The i2c-dev backend keeps the same limits, so a sketch moved to a Linux
+// # board makes the same transfers.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "Wire.h"
+
+static int host_ioctl(int fd, unsigned long request, void *arg)
+{
+  return ioctl(fd, request, arg);
+}
+
+// *********************************************
+// Bus cost accounting
+// *********************************************
+uint32_t TwoWireStats::bits(void) const
+{
+  return bytes * 9 + starts + stops;
+}
+
+uint32_t TwoWireStats::busMicros(uint32_t hz) const
+{
+  return (uint32_t)(((uint64_t)bits() * 1000000UL + hz - 1) / hz);
+}
+
+// *********************************************
+// Public functions
+// *********************************************
+TwoWire::TwoWire(TwoWireDevice *device)
+{
+  clockHz = 100000UL;
+  beginCount = 0;
+  stats.clear();
+  memset(devices, 0, sizeof(devices));
+  devices[0] = device;
+  busOwned = false;
+  txAddress = 0;
+  txLength = 0;
+  rxIndex = 0;
+  rxLength = 0;
+  deviceFd = -1;
+  deviceOwned = false;
+  deviceIoctl = 0;
+  txPending = false;
+}
+
+void TwoWire::begin(void)
+{
+  beginCount++;
+}
+
+void TwoWire::setClock(uint32_t hz)
+{
+  clockHz = hz;
+}
+
+void TwoWire::attach(TwoWireDevice *device)
+{
+  for( uint8_t i = 0; i < 4; i++ )
+  {
+    if ( devices[i] == device )
+      return;
+    if ( devices[i] == 0 )
+    {
+      devices[i] = device;
+      return;
+    }
+  }
+}
+
+void TwoWire::advance(uint32_t us)
+{
+  for( uint8_t i = 0; i < 4; i++ )
+    if ( devices[i] != 0 )
+      devices[i]->advance(us);
+}
+
+boolean TwoWire::openDevice(const char *path)
+{
+  int fd = open(path, O_RDWR);
+  if ( fd < 0 )
+    return false;
+  useDevice(fd, host_ioctl);
+  deviceOwned = true;
+  return true;
+}
+
+void TwoWire::useDevice(int fd, TwoWireIoctl fn)
+{
+  closeDevice();
+  deviceFd = fd;
+  deviceIoctl = fn;
+}
+
+void TwoWire::closeDevice(void)
+{
+  if ( deviceOwned )
+    close(deviceFd);
+  deviceFd = -1;
+  deviceOwned = false;
+  deviceIoctl = 0;
+  txPending = false;
+}
+
+void TwoWire::beginTransmission(uint8_t address)
+{
+  if ( txPending )
+    deviceTransfer(txAddress, 0);       // endTransmission(false) without a read: send the write alone
+  txAddress = address;
+  txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t data)
+{
+  if ( txLength >= BUFFER_LENGTH )
+    return 0;                           // silently dropped, like the AVR library
+  txBuffer[txLength++] = data;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t quantity)
+{
+  size_t n = 0;
+  while( n < quantity && write(data[n]) )
+    n++;
+  return n;
+}
+
+uint8_t TwoWire::endTransmission(uint8_t sendStop)
+{
+  if ( deviceFd >= 0 )
+  {
+    if ( !sendStop )
+    {
+      txPending = true;                 // sent by requestFrom(), a NACK shows up there
+      return 0;
+    }
+    return deviceTransfer(txAddress, 0) ? 0 : 2;
+  }
+  TwoWireDevice *device = find(txAddress);
+  if ( device == 0 )
+  {
+    stats.nacks++;
+    busCondition(1, 1);                 // address byte, NACK, master sends STOP
+    return 2;
+  }
+  device->busWrite(txBuffer, txLength);
+  busCondition(1 + txLength, sendStop);
+  return 0;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop)
+{
+  TwoWireDevice *device = find(address);
+  rxIndex = 0;
+  rxLength = 0;
+  if ( quantity > BUFFER_LENGTH )
+    quantity = BUFFER_LENGTH;
+  if ( deviceFd >= 0 )
+  {
+    if ( txPending && txAddress != address )
+      deviceTransfer(txAddress, 0);
+    if ( !deviceTransfer(address, quantity) )
+      return 0;
+    rxLength = quantity;
+    return quantity;
+  }
+  if ( device == 0 )
+  {
+    stats.nacks++;
+    busCondition(1, 1);
+    return 0;
+  }
+  device->busRead(rxBuffer, quantity);
+  rxLength = quantity;
+  busCondition(1 + quantity, sendStop);
+  return quantity;
+}
+
+int TwoWire::available(void)
+{
+  return rxLength - rxIndex;
+}
+
+int TwoWire::read(void)
+{
+  if ( rxIndex >= rxLength )
+    return -1;
+  return rxBuffer[rxIndex++];
+}
+
+int TwoWire::peek(void)
+{
+  if ( rxIndex >= rxLength )
+    return -1;
+  return rxBuffer[rxIndex];
+}
+
+// *********************************************
+// Private functions
+// *********************************************
+/*
+  One ioctl(I2C_RDWR): the held back write if there is one, followed by a
+  read of quantity bytes into rxBuffer if quantity is not 0. The kernel
+  puts a repeated START between the messages and a STOP at the end.
+*/
+boolean TwoWire::deviceTransfer(uint8_t address, uint8_t quantity)
+{
+  struct i2c_msg msgs[2];
+  struct i2c_rdwr_ioctl_data data;
+  uint32_t n = 0;
+  if ( txPending || quantity == 0 )
+  {
+    msgs[n].addr = txAddress;
+    msgs[n].flags = 0;
+    msgs[n].len = txLength;
+    msgs[n].buf = txBuffer;
+    n++;
+  }
+  txPending = false;
+  if ( quantity > 0 )
+  {
+    msgs[n].addr = address;
+    msgs[n].flags = I2C_M_RD;
+    msgs[n].len = quantity;
+    msgs[n].buf = rxBuffer;
+    n++;
+  }
+  data.msgs = msgs;
+  data.nmsgs = n;
+  stats.ioctls++;
+  if ( deviceIoctl(deviceFd, I2C_RDWR, &data) < 0 )
+  {
+    stats.nacks++;
+    busCondition(1, 1);
+    return false;
+  }
+  for( uint32_t i = 0; i < n; i++ )
+    busCondition(1 + msgs[i].len, i + 1 == n);
+  return true;
+}
+
+TwoWireDevice *TwoWire::find(uint8_t address)
+{
+  for( uint8_t i = 0; i < 4; i++ )
+    if ( devices[i] != 0 && devices[i]->address == address )
+      return devices[i];
+  return 0;
+}
+
+// account one addressed transfer and let the virtual time pass
+void TwoWire::busCondition(uint8_t bytes, uint8_t sendStop)
+{
+  TwoWireStats t;
+  t.clear();
+  t.transactions = 1;
+  t.starts = 1;                         // START, or repeated START if the bus is still owned
+  t.bytes = bytes;
+  t.stops = sendStop ? 1 : 0;
+  busOwned = !sendStop;
+  stats.transactions += t.transactions;
+  stats.starts += t.starts;
+  stats.stops += t.stops;
+  stats.bytes += t.bytes;
+  hostAdvance(t.busMicros(clockHz));
+}
@@ -0,0 +1,119 @@
+// #############################################################################
+// #
+// # Scriptname : Wire.h
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Host (Linux) stand-in for the Arduino TwoWire class. All transfers go to
+// # the simulated devices attached to the bus (see DS1307Sim.h) and every
+// # transfer is accounted for: transactions, START/STOP conditions, bytes on
+// # the wire and bus time. The bus object Wire is defined by WireSim.cpp,
+// # with the simulated DS1307 RTCSim attached, or by WireDevice.cpp without
+// # any simulator for builds that only use the i2c-dev backend.
+// # After openDevice() the transfers go to a Linux i2c-dev bus (/dev/i2c-N)
+// # instead, one ioctl(I2C_RDWR) per transfer. A write ended with
+// # endTransmission(false) is held back and sent together with the next
+// # requestFrom() as a write+read message pair, so a register read is one
+// # kernel round trip.
+// #
+// #############################################################################
+#ifndef TwoWire_h
+#define TwoWire_h
+
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Arduino.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define BUFFER_LENGTH 32                // same as the AVR Wire library
+
+// stand-in for ioctl(), see TwoWire::useDevice()
+typedef int (*TwoWireIoctl)(int fd, unsigned long request, void *arg);
+
+// *********************************************
+// Simulated devices
+// *********************************************
+class TwoWireDevice
+{
+  public:
+    uint8_t address;                    // 7 bit bus address
+    virtual void busWrite(const uint8_t *data, uint8_t quantity) = 0;
+    virtual void busRead(uint8_t *data, uint8_t quantity) = 0;
+    virtual void advance(uint32_t us) = 0; // let us microseconds of virtual time pass
+};
+
+// *********************************************
+// Bus cost accounting
+// *********************************************
+struct TwoWireStats
+{
+  uint32_t transactions;                // addressed transfers (one per START or repeated START)
+  uint32_t starts;                      // START and repeated START conditions
+  uint32_t stops;                       // STOP conditions
+  uint32_t bytes;                       // bytes on the wire, address bytes included
+  uint32_t nacks;                       // transfers not acknowledged by any device
+  uint32_t ioctls;                      // kernel round trips of the i2c-dev backend
+
+  void clear(void) { memset(this, 0, sizeof(*this)); }
+  uint32_t bits(void) const;            // SCL periods: 9 per byte plus one per START/STOP
+  uint32_t busMicros(uint32_t hz) const; // modelled bus time at the given SCL frequency
+};
+
+// *********************************************
+// Library interface description
+// *********************************************
+class TwoWire
+{
+  public:
+    TwoWire(TwoWireDevice *device = 0); // device: attached from the start
+    void begin(void);
+    void setClock(uint32_t hz);
+    void beginTransmission(uint8_t address);
+    void beginTransmission(int address) { beginTransmission((uint8_t)address); }
+    uint8_t endTransmission(uint8_t sendStop = 1);
+    uint8_t requestFrom(uint8_t address, uint8_t quantity, uint8_t sendStop = 1);
+    uint8_t requestFrom(int address, int quantity, int sendStop = 1) { return requestFrom((uint8_t)address, (uint8_t)quantity, (uint8_t)sendStop); }
+    size_t write(uint8_t data);
+    size_t write(const uint8_t *data, size_t quantity);
+    int available(void);
+    int read(void);
+    int peek(void);
+
+    // Linux i2c-dev backend
+    boolean openDevice(const char *path); // e.g. "/dev/i2c-1", false if it can not be opened
+    void useDevice(int fd, TwoWireIoctl fn); // transfers call fn instead of ioctl(), for tests
+    void closeDevice(void);             // back to the simulated devices
+    static int simulatedIoctl(int fd, unsigned long request, void *arg); // I2C_RDWR served by the simulated devices, in WireSim.cpp
+
+    // simulator side
+    void attach(TwoWireDevice *device); // put a device on the bus (up to four)
+    void advance(uint32_t us);          // run the oscillators of all devices
+    uint32_t clockHz;
+    uint8_t beginCount;                 // number of begin() calls, to check lazy start-up
+    TwoWireStats stats;
+
+  private:
+    TwoWireDevice *devices[4];
+    TwoWireDevice *find(uint8_t address);
+    void busCondition(uint8_t bytes, uint8_t sendStop);
+    boolean busOwned;                   // true between a repeated START request and the STOP
+    uint8_t txAddress;
+    uint8_t txBuffer[BUFFER_LENGTH];
+    uint8_t txLength;
+    uint8_t rxBuffer[BUFFER_LENGTH];
+    uint8_t rxIndex;
+    uint8_t rxLength;
+    int deviceFd;                       // i2c-dev file, -1 = simulated devices
+    boolean deviceOwned;                // opened by openDevice(), closed by closeDevice()
+    TwoWireIoctl deviceIoctl;
+    boolean txPending;                  // write held back by endTransmission(false)
+    boolean deviceTransfer(uint8_t address, uint8_t quantity);
+};
+
+extern TwoWire Wire;
+
+#endif
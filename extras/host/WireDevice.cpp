@@ -0,0 +1,21 @@
+// #############################################################################
+// #
+// # Scriptname : WireDevice.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Bus object of the builds for a Linux board: Wire has no simulated
+// # device, the sketch calls Wire.openDevice("/dev/i2c-N") first. Neither
+// # DS1307Sim nor RTCSim is linked, time comes from ArduinoHostDevice.cpp.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Wire.h"
+
+// *********************************************
+// Define bus object
+// *********************************************
+TwoWire Wire;
@@ -0,0 +1,62 @@
+// #############################################################################
+// #
+// # Scriptname : WireSim.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Bus object of the simulator builds: Wire starts with the simulated
+// # DS1307 RTCSim attached. TwoWire::simulatedIoctl serves the i2c-dev
+// # backend from the simulated devices. Link this file and DS1307Sim.cpp,
+// # or WireDevice.cpp alone for a build that only talks to real hardware.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <errno.h>
+#include <linux/i2c.h>
+#include <linux/i2c-dev.h>
+#include "Wire.h"
+#include "DS1307Sim.h"
+
+// *********************************************
+// Public functions
+// *********************************************
+/*
+  I2C_RDWR for the simulated devices, for useDevice(). All messages of a
+  call go to the devices attached to Wire, the call fails with ENXIO
+  (nothing transferred) if an address is not on the bus.
+*/
+int TwoWire::simulatedIoctl(int fd, unsigned long request, void *arg)
+{
+  struct i2c_rdwr_ioctl_data *data = (struct i2c_rdwr_ioctl_data *)arg;
+  (void)fd;
+  if ( request != I2C_RDWR )
+  {
+    errno = EINVAL;
+    return -1;
+  }
+  for( uint32_t i = 0; i < data->nmsgs; i++ )
+  {
+    if ( Wire.find(data->msgs[i].addr) == 0 )
+    {
+      errno = ENXIO;
+      return -1;
+    }
+  }
+  for( uint32_t i = 0; i < data->nmsgs; i++ )
+  {
+    struct i2c_msg *m = &data->msgs[i];
+    if ( m->flags & I2C_M_RD )
+      Wire.find(m->addr)->busRead(m->buf, m->len);
+    else
+      Wire.find(m->addr)->busWrite(m->buf, m->len);
+  }
+  return data->nmsgs;
+}
+
+// *********************************************
+// Define bus object
+// *********************************************
+TwoWire Wire(&RTCSim);                  // only the address of RTCSim is taken, its construction order does not matter
@@ -0,0 +1,183 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_alarm_check.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Catch up of alarms that were not polled in their minute: polled late,
+// # exactly at the minute, by a new object after a power loss, after a
+// # sleep longer than DS1307_ALARM_CATCH_UP, an alarm added for a time that
+// # has passed, the clock set back, one shot alarms, alarm calls of an
+// # object that has not read the time yet, and state bytes that do not
+// # belong to the table: after the conversion of the old layout, after a
+// # damaged table and a state after the current minute.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Arduino.h"
+#include "Wire.h"
+#include "DS1307Sim.h"
+#include "DS1307new.h"
+#include "HostCheck.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define STATE_REGISTER (0x08 + DS1307_ALARM_STATE_ADDRESS)
+
+// *********************************************
+// Helpers
+// *********************************************
+static void advanceSeconds(uint32_t s)
+{
+  while( s > 0 )
+  {
+    uint32_t step = s > 3600 ? 3600 : s;
+    hostAdvance(step * 1000000UL);
+    s -= step;
+  }
+}
+
+// write the state bytes: minute m after 2000-01-01
+static void setState(uint32_t m)
+{
+  RTCSim.reg[STATE_REGISTER] = m;
+  RTCSim.reg[STATE_REGISTER + 1] = m >> 8;
+  RTCSim.reg[STATE_REGISTER + 2] = m >> 16;
+}
+
+static uint32_t getState(void)
+{
+  return RTCSim.reg[STATE_REGISTER] | ((uint32_t)RTCSim.reg[STATE_REGISTER + 1] << 8) | ((uint32_t)RTCSim.reg[STATE_REGISTER + 2] << 16);
+}
+
+// report all pending alarms of rtc, counts the alarms and the missed ones among them
+static uint8_t drain(DS1307new &rtc, uint8_t *missed)
+{
+  uint8_t fired = 0;
+  *missed = 0;
+  rtc.getTime();
+  while( fired <= 50 && rtc.isAlarmTime() )
+  {
+    fired++;
+    if ( rtc.isAlarmMissed() )
+      (*missed)++;
+  }
+  return fired;
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  uint8_t fired, missed;
+
+  RTCSim.setDateTime(2012, 7, 30, 5, 0, 0);
+  RTCSim.reg[0] &= 0x7f;                // oscillator running
+  RTC.getTime();
+  RTC.clearAlarmNvramMemory();
+  RTC.addAlarm(5, 25, DS1307_EVERY_DAY);
+  RTC.addAlarm(6, 0, DS1307_EVERY_DAY);
+
+  // 05:25 and 06:00 checked first at 06:10
+  advanceSeconds(70UL * 60);
+  fired = drain(RTC, &missed);
+  CHECK(fired == 2 && missed == 2);
+  fired = drain(RTC, &missed);
+  CHECK(fired == 0);
+
+  // polled in the minute of the alarm
+  RTC.getTime();
+  advanceSeconds(86400UL - 70 * 60 + 25 * 60 - RTC.second);
+  fired = drain(RTC, &missed);
+  CHECK(fired == 1 && missed == 0);
+
+  // power loss of 3 days, a new object reports the missed alarms
+  advanceSeconds(3 * 86400UL);
+  DS1307new other;
+  fired = drain(other, &missed);
+  CHECK(fired == 6 && missed >= 5);
+
+  // a sleep of 30 days reports DS1307_ALARM_CATCH_UP (7 days) only
+  advanceSeconds(30 * 86400UL);
+  fired = drain(RTC, &missed);
+  CHECK(fired == 14 || fired == 15);
+
+  // an alarm added for a time that has passed today is not reported
+  RTC.getTime();
+  RTC.addAlarm(5, 10, DS1307_EVERY_DAY);
+  fired = drain(RTC, &missed);
+  CHECK(fired == 0);
+
+  // the clock set back by a day: the alarms repeat
+  RTC.getTime();
+  RTC.fillByTime2000(RTC.time2000 - 86400UL);
+  RTC.setTime();
+  RTC.startClock();
+  RTC.getTime();
+  CHECK(RTC.nextAlarmTime2000() >= RTC.time2000);
+
+  // one shot alarm caught up after 2 days, then deleted
+  RTC.addAlarm(23, 0, DS1307_EVERY_DAY, true);
+  advanceSeconds(2 * 86400UL);
+  fired = drain(RTC, &missed);
+  CHECK(fired == 8 && RTC.getAlarmCount() == 3);
+
+  // nextAlarmTime2000() points at a missed alarm that has not been reported
+  advanceSeconds(86400UL);
+  RTC.getTime();
+  CHECK(RTC.nextAlarmTime2000() < RTC.time2000);
+  CHECK(RTC.secondsUntilNextAlarm() == 0);
+  fired = drain(RTC, &missed);
+
+  // alarm calls before the first getTime() neither report nor store anything
+  advanceSeconds(86400UL);
+  uint8_t state[3];
+  memcpy(state, RTCSim.reg + STATE_REGISTER, sizeof(state));
+  DS1307new unread;
+  CHECK(!unread.isAlarmTime());
+  CHECK(unread.nextAlarmTime2000() == DS1307_NO_ALARM);
+  CHECK(unread.secondsUntilNextAlarm() == DS1307_NO_ALARM);
+  CHECK(memcmp(state, RTCSim.reg + STATE_REGISTER, sizeof(state)) == 0);
+  fired = drain(unread, &missed);       // the alarms of the past day are still reported
+  CHECK(fired == 3 && missed >= 2);
+
+  // a table of the old layout is converted, the state bytes it never wrote are not used
+  RTC.getTime();
+  uint32_t now = RTC.time2000 / 60;
+  setState(now - 2 * 1440);             // would report the alarms of two days
+  RTCSim.reg[0x08 + 1] = 0x7f;          // weekday bits: every day
+  memset(RTCSim.reg + 0x08 + 2, (RTC.hour * 60 - 240) / 5, 7);   // code of the last full hour
+  DS1307new legacy;
+  fired = drain(legacy, &missed);
+  CHECK(fired == 0 && legacy.getAlarmCount() > 0);
+  advanceSeconds(86400UL);
+  fired = drain(legacy, &missed);
+  CHECK(fired == 1 && missed == 1);
+
+  // a damaged table is rebuilt, the same
+  RTC.getTime();
+  RTC.addAlarm(RTC.hour, 0, DS1307_EVERY_DAY);
+  setState(RTC.time2000 / 60 - 2 * 1440);
+  RTCSim.reg[0x08 + 3] ^= 0x01;         // CRC
+  DS1307new damaged;
+  fired = drain(damaged, &missed);
+  CHECK(fired == 0 && damaged.getAlarmCount() == 0);
+  CHECK(getState() == damaged.time2000 / 60 - 1);
+
+  // a state after the current minute is not used (before 2031-11-24 it
+  // would be taken as a time of the future, after it as 32 years ago)
+  RTCSim.setDateTime(2040, 3, 1, 12, 0, 0);
+  RTCSim.reg[0] &= 0x7f;
+  RTC.getTime();
+  RTC.addAlarm(11, 0, DS1307_EVERY_DAY);
+  setState(RTC.time2000 / 60 + 1000);
+  DS1307new future;
+  fired = drain(future, &missed);
+  CHECK(fired == 0);
+  return checkResult("alarm catch up");
+}
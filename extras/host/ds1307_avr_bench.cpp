@@ -0,0 +1,178 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_avr_bench.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Cycle counts of the date kernels on an 8 bit AVR, run under simavr by
+// # "make avr-bench". Timer 1 runs at the CPU clock and is read before and
+// # after each call; every kernel is called for 64 inputs spread over the
+// # whole time2000 range and the mean and maximum cycles are printed on
+// # UART0, one line per kernel:
+// #   <kernel> <mean cycles> <max cycles>
+// # Only the library and this file are linked: the bus and Serial parts of
+// # the library are dropped by --gc-sections, the stubs below satisfy the
+// # global objects.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <avr/io.h>
+#include <avr/sleep.h>
+#include "Arduino.h"
+#include "Wire.h"
+#include "DS1307new.h"
+
+#ifndef DS1307_KERNEL_BENCH
+#error "build with -DDS1307_KERNEL_BENCH (see Makefile), the kernels are private to DS1307new"
+#endif
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define SAMPLES 64
+#define LAST_CDN 49710U                 // 2136-02-07, the day time2000 ends
+
+// *********************************************
+// Stubs for the global objects of the library
+// *********************************************
+TwoWire::TwoWire(TwoWireDevice *device) { (void)device; }
+TwoWire Wire;
+HardwareSerial Serial;
+
+// *********************************************
+// Access to the private kernels
+// *********************************************
+class DS1307newKernelBench
+{
+  public:
+    static void calculate_ydn(DS1307new &t) { t.calculate_ydn(); }
+    static void calculate_month_by_year_and_ydn(DS1307new &t) { t.calculate_month_by_year_and_ydn(); }
+    static uint8_t dec2bcd(DS1307new &t, uint8_t v) { return t.dec2bcd(v); }
+    static uint8_t bcd2dec(DS1307new &t, uint8_t v) { return t.bcd2dec(v); }
+};
+typedef DS1307newKernelBench K;
+
+// *********************************************
+// UART0 output, simavr prints it on stdout
+// *********************************************
+static void uart_putc(char c)
+{
+  while( !(UCSR0A & (1 << UDRE0)) )
+    ;
+  UDR0 = c;
+}
+
+static void uart_puts(const char *s)
+{
+  while( *s != '\0' )
+    uart_putc(*s++);
+}
+
+static void uart_putu(uint32_t v)
+{
+  char buf[11];
+  uint8_t n = 0;
+  do
+  {
+    buf[n++] = '0' + v % 10;
+    v /= 10;
+  } while( v != 0 );
+  while( n > 0 )
+    uart_putc(buf[--n]);
+}
+
+// *********************************************
+// Kernels, i is the sample number 0 .. SAMPLES-1
+// *********************************************
+static DS1307new subject;
+static volatile uint8_t sink;          // keeps the results alive
+
+static uint32_t sample_time2000(uint8_t i) { return (uint32_t)i * 67108863UL + 12345UL; }
+static uint16_t sample_cdn(uint8_t i) { return (uint32_t)i * LAST_CDN / (SAMPLES - 1); }
+
+static void prepare_none(uint8_t i) { (void)i; }
+static void prepare_ymd(uint8_t i) { subject.fillByCDN(sample_cdn(i)); }
+
+static void run_empty(uint8_t i) { (void)i; }
+static void run_fillByTime2000(uint8_t i) { subject.fillByTime2000(sample_time2000(i)); }
+static void run_fillByCDN(uint8_t i) { subject.fillByCDN(sample_cdn(i)); }
+static void run_fillByYMD(uint8_t i) { (void)i; subject.fillByYMD(subject.year, subject.month, subject.day); }
+static void run_calculate_ydn(uint8_t i) { (void)i; K::calculate_ydn(subject); }
+static void run_calculate_month(uint8_t i) { (void)i; K::calculate_month_by_year_and_ydn(subject); }
+static void run_bcd(uint8_t i) { sink = K::bcd2dec(subject, K::dec2bcd(subject, i)); }
+static void run_isCETSummerTime(uint8_t i) { (void)i; sink = subject.isCETSummerTime(); }
+
+static void prepare_time2000(uint8_t i) { subject.fillByTime2000(sample_time2000(i)); }
+
+struct kernel
+{
+  const char *name;
+  void (*prepare)(uint8_t i);           // not counted
+  void (*run)(uint8_t i);
+};
+
+static const kernel kernels[] =
+{
+  { "fillByTime2000", prepare_none, run_fillByTime2000 },
+  { "fillByCDN", prepare_none, run_fillByCDN },
+  { "fillByYMD", prepare_ymd, run_fillByYMD },
+  { "calculate_ydn", prepare_ymd, run_calculate_ydn },
+  { "calculate_month_by_year_and_ydn", prepare_ymd, run_calculate_month },
+  { "dec2bcd+bcd2dec", prepare_none, run_bcd },
+  { "isCETSummerTime", prepare_time2000, run_isCETSummerTime },
+};
+
+// cycles of one call, including the call through the pointer
+static uint16_t cycles(const kernel &k, uint8_t i)
+{
+  uint16_t t0, t1;
+  k.prepare(i);
+  cli();
+  t0 = TCNT1;
+  k.run(i);
+  t1 = TCNT1;
+  sei();
+  return t1 - t0;
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  kernel empty = { "", prepare_none, run_empty };
+  uint16_t overhead;
+  UBRR0 = 8;                            // 115200 baud at 16 MHz, simavr does not care
+  UCSR0B = 1 << TXEN0;
+  TCCR1A = 0;
+  TCCR1B = 1 << CS10;                   // timer 1 counts CPU cycles
+  overhead = cycles(empty, 0);
+
+  uart_puts("kernel mean max (AVR cycles per call)\n");
+  for( uint8_t k = 0; k < sizeof(kernels) / sizeof(kernels[0]); k++ )
+  {
+    uint32_t sum = 0;
+    uint16_t max = 0;
+    for( uint8_t i = 0; i < SAMPLES; i++ )
+    {
+      uint16_t c = cycles(kernels[k], i) - overhead;
+      sum += c;
+      if ( c > max )
+        max = c;
+    }
+    uart_puts(kernels[k].name);
+    uart_putc(' ');
+    uart_putu(sum / SAMPLES);
+    uart_putc(' ');
+    uart_putu(max);
+    uart_putc('\n');
+  }
+  // sleeping with interrupts off ends the simulation
+  cli();
+  sleep_enable();
+  sleep_cpu();
+  return 0;
+}
@@ -0,0 +1,158 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_batch_bench.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Throughput of decodeTime2000Array() and encodeTime2000Array() against
+// # the scalar fillByTime2000() / fillByYMD() path, in time stamps per
+// # second. Both paths are checked to give the same results.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <stdio.h>
+#include <time.h>
+#include "Arduino.h"
+#include "DS1307new.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define STAMPS (1UL << 22)
+#define RUNS 5
+
+// *********************************************
+// Helpers
+// *********************************************
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+struct time_columns
+{
+  uint16_t year[STAMPS];
+  uint8_t month[STAMPS], day[STAMPS], hour[STAMPS], minute[STAMPS], second[STAMPS], dow[STAMPS];
+  DS1307newTimeArrays arrays(void)
+  {
+    DS1307newTimeArrays a = { year, month, day, hour, minute, second, dow };
+    return a;
+  }
+};
+
+static uint32_t stamps[STAMPS], encoded[STAMPS];
+static time_columns scalar, batch;
+
+static void decode_scalar(void)
+{
+  DS1307new t;
+  for( size_t i = 0; i < STAMPS; i++ )
+  {
+    t.fillByTime2000(stamps[i]);
+    scalar.year[i] = t.year;
+    scalar.month[i] = t.month;
+    scalar.day[i] = t.day;
+    scalar.hour[i] = t.hour;
+    scalar.minute[i] = t.minute;
+    scalar.second[i] = t.second;
+    scalar.dow[i] = t.dow;
+  }
+}
+
+static void decode_batch(void)
+{
+  DS1307new::decodeTime2000Array(stamps, batch.arrays(), STAMPS);
+}
+
+static void encode_scalar(void)
+{
+  DS1307new t;
+  for( size_t i = 0; i < STAMPS; i++ )
+  {
+    t.fillByYMD(scalar.year[i], scalar.month[i], scalar.day[i]);
+    t.fillByHMS(scalar.hour[i], scalar.minute[i], scalar.second[i]);
+    encoded[i] = t.time2000;
+  }
+}
+
+static void encode_batch(void)
+{
+  DS1307new::encodeTime2000Array(batch.arrays(), encoded, STAMPS);
+}
+
+// best of RUNS, in stamps per second
+static double measure(void (*fn)(void))
+{
+  double best = 1e30;
+  for( int r = 0; r < RUNS; r++ )
+  {
+    double start = now_seconds();
+    fn();
+    double t = now_seconds() - start;
+    if ( t < best )
+      best = t;
+  }
+  return STAMPS / best;
+}
+
+static boolean same_columns(void)
+{
+  return memcmp(scalar.year, batch.year, sizeof(scalar.year)) == 0
+    && memcmp(scalar.month, batch.month, STAMPS) == 0
+    && memcmp(scalar.day, batch.day, STAMPS) == 0
+    && memcmp(scalar.hour, batch.hour, STAMPS) == 0
+    && memcmp(scalar.minute, batch.minute, STAMPS) == 0
+    && memcmp(scalar.second, batch.second, STAMPS) == 0
+    && memcmp(scalar.dow, batch.dow, STAMPS) == 0;
+}
+
+static boolean round_trip(void)
+{
+  return memcmp(stamps, encoded, sizeof(stamps)) == 0;
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  uint32_t x = 2463534242UL;
+  for( size_t i = 0; i < STAMPS; i++ )  // xorshift32, covers the whole time2000 range
+  {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    stamps[i] = x;
+  }
+
+  double scalar_decode = measure(decode_scalar);
+  double batch_decode = measure(decode_batch);
+  if ( !same_columns() )
+  {
+    printf("decodeTime2000Array() differs from fillByTime2000()\n");
+    return 1;
+  }
+  double scalar_encode = measure(encode_scalar);
+  if ( !round_trip() )
+  {
+    printf("fillByYMD() does not give the original time stamps\n");
+    return 1;
+  }
+  memset(encoded, 0, sizeof(encoded));
+  double batch_encode = measure(encode_batch);
+  if ( !round_trip() )
+  {
+    printf("encodeTime2000Array() does not give the original time stamps\n");
+    return 1;
+  }
+
+  printf("%-8s %14s %14s %8s\n", "", "scalar/s", "batch/s", "speedup");
+  printf("%-8s %14.0f %14.0f %7.1fx\n", "decode", scalar_decode, batch_decode, batch_decode / scalar_decode);
+  printf("%-8s %14.0f %14.0f %7.1fx\n", "encode", scalar_encode, batch_encode, batch_encode / scalar_encode);
+  return 0;
+}
@@ -0,0 +1,84 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_carry_check.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # tick(), addSeconds(), addMinutes() and addDays() carry into the next
+// # field instead of recalculating the object. All fields are compared with
+// # fillByTime2000() of the expected time: tick() over every midnight of
+// # the time2000 range, then random steps of all four calls.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Arduino.h"
+#include "DS1307new.h"
+#include "HostCheck.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define STEPS 3000000UL
+#define LAST_MIDNIGHT 49709UL           // 2136-02-06, the last day with a following midnight
+
+// *********************************************
+// Helpers
+// *********************************************
+static boolean same(DS1307new &a, uint32_t t)
+{
+  DS1307new c;
+  c.fillByTime2000(t);
+  return a.time2000 == t && c.second == a.second && c.minute == a.minute && c.hour == a.hour && c.day == a.day
+    && c.month == a.month && c.year == a.year && c.dow == a.dow && c.cdn == a.cdn && c.ydn == a.ydn;
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  DS1307new a;
+  uint32_t t;
+
+  for( uint32_t d = 0; d <= LAST_MIDNIGHT - 1; d++ )
+  {
+    t = d * 86400UL + 86399UL;          // 23:59:59
+    a.fillByTime2000(t);
+    a.tick();
+    CHECK(same(a, t + 1));
+  }
+
+  uint32_t x = 2463534242UL;
+  t = 0;
+  a.fillByTime2000(t);
+  for( unsigned long i = 0; i < STEPS; i++ )
+  {
+    x ^= x << 13;                       // xorshift32
+    x ^= x >> 17;
+    x ^= x << 5;
+    if ( t > 4200000000UL )
+    {
+      t = x >> 1;
+      a.fillByTime2000(t);
+    }
+    switch( x & 3 )
+    {
+      case 0: a.addSeconds(x % 90000); t += x % 90000; break;
+      case 1: a.addMinutes(x % 1500); t += (x % 1500) * 60; break;
+      case 2: a.addDays(x % 40); t += (x % 40) * 86400UL; break;
+      case 3: a.tick(); t++; break;
+    }
+    CHECK(same(a, t));
+  }
+
+  // negative steps fall back to fillByTime2000()
+  a.fillByTime2000(1000000);
+  a.addSeconds(-5);
+  CHECK(same(a, 999995));
+  a.addDays(-3);
+  CHECK(same(a, 999995 - 3 * 86400UL));
+  return checkResult("tick() and add calls");
+}
@@ -0,0 +1,75 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_cdn_check.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # fillByCDN() and calculate_cdn() count the years with closed forms. This
+// # compares them with the year by year loops they replaced, for every
+// # 16 bit cdn (2000-01-01 .. 2179-06-06).
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Arduino.h"
+#include "DS1307new.h"
+#include "HostCheck.h"
+
+// *********************************************
+// The loops of DS1307new 1.00
+// *********************************************
+static uint8_t loop_is_leap_year(uint16_t y)
+{
+  return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+// fillByCDN(): year and ydn of a cdn
+static uint16_t loop_year_by_cdn(uint16_t cdn, uint16_t *ydn)
+{
+  uint16_t y = 2000;
+  for(;;)
+  {
+    uint16_t days_per_year = 365 + loop_is_leap_year(y);
+    if ( cdn < days_per_year )
+      break;
+    cdn -= days_per_year;
+    y++;
+  }
+  *ydn = cdn + 1;
+  return y;
+}
+
+// calculate_cdn(): cdn of year and ydn
+static uint16_t loop_cdn(uint16_t y, uint16_t ydn)
+{
+  uint16_t cdn = ydn - 1;
+  while( y > 2000 )
+  {
+    y--;
+    cdn += 365;
+    cdn += loop_is_leap_year(y);
+  }
+  return cdn;
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  DS1307new t, u;
+  uint32_t cdn = 0;
+  do
+  {
+    uint16_t ydn;
+    uint16_t y = loop_year_by_cdn(cdn, &ydn);
+    t.fillByCDN(cdn);
+    CHECK(t.cdn == cdn && t.year == y && t.ydn == ydn);
+    // calculate_cdn() through fillByYMD(), which takes ydn from the date
+    u.fillByYMD(t.year, t.month, t.day);
+    CHECK(u.ydn == ydn && u.cdn == loop_cdn(y, ydn) && u.cdn == cdn);
+  } while( ++cdn <= 0xffffUL );
+  return checkResult("fillByCDN / calculate_cdn against the loops");
+}
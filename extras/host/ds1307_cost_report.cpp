@@ -0,0 +1,120 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_cost_report.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Runs the public DS1307new calls against the simulated DS1307 and prints
+// # the I2C cost of each call: transactions, START/STOP conditions, bytes on
+// # the wire and the modelled bus time at 100 kHz and 400 kHz. The calls are
+// # then repeated through the i2c-dev backend (served by the simulator) to
+// # count the kernel round trips a Linux board needs.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <stdio.h>
+#include "Arduino.h"
+#include "Wire.h"
+#include "DS1307Sim.h"
+#include "DS1307new.h"
+#include "DS1307newScheduler.h"
+
+// *********************************************
+// Measured calls
+// *********************************************
+static void call_getTime(void) { RTC.getTime(); }
+static void call_getCTRL(void) { RTC.getCTRL(); }
+static void call_getRAM(void) { uint8_t ram[DS1307_NVRAM_SIZE]; RTC.getRAM(0, ram, sizeof(ram)); }
+static void call_isAlarmTime(void) { RTC.isAlarmTime(); }
+static void call_setAlarm(void) { RTC.setAlarm(1, 5, 25); }
+static void call_clearAlarmNvramMemory(void) { RTC.clearAlarmNvramMemory(); }
+static void call_setDateTimeRTC(void) { RTC.setDateTimeRTC(); }
+static void call_snapshot(void) { RTC.snapshot(); }
+// what a sketch does every loop, with separate reads and with one burst
+static void call_loop(void) { RTC.getTime(); RTC.getCTRL(); RTC.isTimeSet(); RTC.isAlarmTime(); }
+static void call_snapshot_loop(void) { RTC.snapshot(); RTC.isTimeSet(); RTC.isAlarmTime(); }
+// three modules each reading what they need: logger (time, 8 bytes of state), user interface (time, control), alarm table header
+static uint8_t client_state[8], client_ctrl, client_header[3];
+static void call_clients(void)
+{
+  RTC.getTime();
+  RTC.getRAM(40, client_state, 8);
+  RTC.getTime();
+  RTC.getCTRL();
+  RTC.getRAM(1, client_header, 3);
+}
+static DS1307newScheduler scheduler(RTC);
+static void call_clients_scheduled(void)
+{
+  scheduler.requestTime();
+  scheduler.requestRAM(40, client_state, 8);
+  scheduler.requestTime();
+  scheduler.requestRegisters(0x07, &client_ctrl, 1);
+  scheduler.requestRAM(1, client_header, 3);
+  scheduler.service();
+}
+
+struct measured_call
+{
+  const char *name;
+  void (*fn)(void);
+};
+
+static const measured_call calls[] =
+{
+  { "getTime", call_getTime },
+  { "getCTRL", call_getCTRL },
+  { "getRAM (56 bytes)", call_getRAM },
+  { "isAlarmTime", call_isAlarmTime },
+  { "setAlarm", call_setAlarm },
+  { "clearAlarmNvramMemory", call_clearAlarmNvramMemory },
+  { "setDateTimeRTC", call_setDateTimeRTC },
+  { "snapshot", call_snapshot },
+  { "loop (separate reads)", call_loop },
+  { "loop (snapshot)", call_snapshot_loop },
+  { "3 clients (separate)", call_clients },
+  { "3 clients (scheduler)", call_clients_scheduled },
+};
+
+static void report(const char *name, void (*fn)(void))
+{
+  Wire.stats.clear();
+  fn();
+  const TwoWireStats &s = Wire.stats;
+  printf("%-24s %6lu %6lu %6lu %6lu %9lu %9lu\n", name,
+    (unsigned long)s.transactions, (unsigned long)s.starts, (unsigned long)s.stops,
+    (unsigned long)s.bytes, (unsigned long)s.busMicros(100000UL), (unsigned long)s.busMicros(400000UL));
+}
+
+static void report_ioctls(const char *name, void (*fn)(void))
+{
+  Wire.stats.clear();
+  fn();
+  printf("%-24s %6lu\n", name, (unsigned long)Wire.stats.ioctls);
+}
+
+int main(void)
+{
+  RTCSim.setDateTime(2012, 7, 30, 5, 30, 0);  // a monday, after the 5:25 alarm set below
+  RTC.setAlarm(1, 5, 25);
+  RTC.getTime();
+
+  printf("%-24s %6s %6s %6s %6s %9s %9s\n", "call", "trans", "start", "stop", "bytes", "us@100k", "us@400k");
+  for( size_t i = 0; i < sizeof(calls) / sizeof(calls[0]); i++ )
+    report(calls[i].name, calls[i].fn);
+
+  RTC.enableFastPoll();                 // the first read is a full read
+  RTC.getTime();
+  report("getTime (fast poll)", call_getTime);
+  RTC.disableFastPoll();
+
+  printf("\n%-24s %6s\n", "call (i2c-dev)", "ioctl");
+  Wire.useDevice(0, TwoWire::simulatedIoctl);
+  for( size_t i = 0; i < sizeof(calls) / sizeof(calls[0]); i++ )
+    report_ioctls(calls[i].name, calls[i].fn);
+  Wire.closeDevice();
+  return 0;
+}
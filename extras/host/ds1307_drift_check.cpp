@@ -0,0 +1,236 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_drift_check.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Drift compensation: the corrected time of getTime() against
+// # drift * (t - calibration time) / 10^8 computed for every read, around
+// # every change of the correction and for random times, then calibrate()
+// # and DS1307_DRIFT_AUTO_SET with a simulated crystal that runs 25 ppm
+// # fast. getTime() must not wait for the seconds tick of the chip. Drift
+// # records of random NVRAM, of the older layout, with a drift beyond
+// # DS1307_DRIFT_LIMIT or a calibration time in the future are not used,
+// # setTime() and setDateTimeRTC() restart the calibration.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Arduino.h"
+#include "Wire.h"
+#include "DS1307Sim.h"
+#include "DS1307new.h"
+#include "HostCheck.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define EPOCH 300000000UL               // calibration time of the stored records
+#define RANDOM_READS 200000UL
+#define SIM_DRIFT 2500                  // 0.01 ppm, the simulated crystal
+// the correction is truncated to whole seconds and the chip ticks with its
+// own phase, so the corrected time is -1 .. +2 s off the reference
+
+// *********************************************
+// Helpers
+// *********************************************
+static void setChip(uint32_t t)
+{
+  DS1307new c;
+  c.fillByTime2000(t);
+  RTCSim.setDateTime(c.year, c.month, c.day, c.hour, c.minute, c.second);   // halted
+}
+
+// CRC-8 of the drift record, polynomial 0x31 as the alarm table
+static uint8_t crc8(const uint8_t *data, uint8_t n, uint8_t crc)
+{
+  while( n-- > 0 )
+  {
+    crc ^= *data++;
+    for( uint8_t b = 0; b < 8; b++ )
+      crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+  }
+  return crc;
+}
+
+static void writeRecord(int16_t drift, uint32_t epoch)
+{
+  uint8_t rec[DS1307_DRIFT_RECORD_SIZE];
+  rec[0] = DS1307_DRIFT_FORMAT;
+  rec[2] = drift;
+  rec[3] = (uint16_t)drift >> 8;
+  rec[4] = epoch;
+  rec[5] = epoch >> 8;
+  rec[6] = epoch >> 16;
+  rec[7] = epoch >> 24;
+  rec[8] = 0;
+  rec[9] = 0;
+  rec[1] = crc8(rec + 2, sizeof(rec) - 2, crc8(rec, 1, 0));
+  memcpy(RTCSim.reg + 8 + DS1307_DRIFT_ADDRESS, rec, sizeof(rec));
+}
+
+static void storeRecord(int16_t drift, uint32_t epoch)
+{
+  writeRecord(drift, epoch);
+  setChip(epoch);                       // the record is loaded at the calibration time
+  RTC.setDriftCompensation(DS1307_DRIFT_CORRECT);
+}
+
+// the corrected time of a new object that has loaded the NVRAM, for the chip at t
+static uint32_t loadedTime(uint32_t t)
+{
+  DS1307new rtc;
+  setChip(t);
+  rtc.setDriftCompensation(DS1307_DRIFT_CORRECT);
+  rtc.getTime();
+  return rtc.time2000;
+}
+
+static boolean corrected(int16_t drift, uint32_t t)
+{
+  setChip(t);
+  RTC.getTime();
+  return RTC.time2000 == t - (int32_t)((int64_t)drift * (int32_t)(t - EPOCH) / 100000000LL);
+}
+
+// reference time: the virtual host time, started at 2020-01-01 00:00:00
+static uint32_t referenceBase;
+static uint64_t referenceMicros;
+static uint32_t lastMicros;
+
+static uint32_t reference(void)
+{
+  uint32_t m = micros();
+  referenceMicros += (uint32_t)(m - lastMicros);
+  lastMicros = m;
+  return referenceBase + referenceMicros / 1000000;
+}
+
+static void run(uint32_t seconds)
+{
+  while( seconds-- > 0 )
+  {
+    delay(1000);
+    reference();
+  }
+}
+
+static int32_t chipError(void)
+{
+  DS1307new raw;
+  raw.getTime();
+  return raw.time2000 - reference();
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  static const int16_t drifts[] = { 1, -1, 7, -7, 2500, -2500, 12345, -12345, 20000, -20000 };
+  uint32_t x = 2463534242UL;
+
+  for( uint8_t i = 0; i < sizeof(drifts) / sizeof(drifts[0]); i++ )
+  {
+    int16_t d = drifts[i];
+    uint32_t magnitude = d < 0 ? -d : d;
+    storeRecord(d, EPOCH);
+    // both sides of the first changes of the correction, forwards and backwards
+    for( uint32_t q = 0; q < 40; q++ )
+    {
+      uint32_t change = EPOCH + (uint32_t)(((uint64_t)q * 100000000ULL + magnitude - 1) / magnitude);
+      CHECK(corrected(d, change - 1));
+      CHECK(corrected(d, change));
+      CHECK(corrected(d, change + 1));
+    }
+    for( uint32_t q = 40; q-- > 0; )
+      CHECK(corrected(d, EPOCH + (uint32_t)(((uint64_t)q * 100000000ULL + magnitude - 1) / magnitude)));
+    // random times, also before the calibration and beyond elapsed = 2^31 s
+    for( unsigned long n = 0; n < RANDOM_READS / 10; n++ )
+    {
+      x ^= x << 13;                     // xorshift32
+      x ^= x >> 17;
+      x ^= x << 5;
+      CHECK(corrected(d, x % 4 == 0 ? x % 3155760000UL : EPOCH + x % 100000000UL));   // the chip ends with 2099
+    }
+  }
+
+  // records that are not used: NVRAM that has not been written by calibrate()
+  // (random or of an older layout), a drift beyond the limit, a calibration in the future
+  for( uint8_t r = 8; r < 0x40; r++ )
+    RTCSim.reg[r] = r * 37 + 11;
+  CHECK(loadedTime(EPOCH + 86400UL) == EPOCH + 86400UL);
+  memcpy(RTCSim.reg + 8 + 46, "\x20\x4e\x00\x00\x00\x00\x00", 7);  // 200 ppm since 2000 in the layout without format byte and CRC
+  CHECK(loadedTime(EPOCH) == EPOCH);
+  writeRecord(DS1307_DRIFT_LIMIT + 1, EPOCH);
+  CHECK(loadedTime(EPOCH + 86400UL) == EPOCH + 86400UL);
+  writeRecord(-DS1307_DRIFT_LIMIT - 1, EPOCH);
+  CHECK(loadedTime(EPOCH + 86400UL) == EPOCH + 86400UL);
+  writeRecord(DS1307_DRIFT_LIMIT, EPOCH + 86400UL);
+  CHECK(loadedTime(EPOCH + 86399UL) == EPOCH + 86399UL);
+  writeRecord(DS1307_DRIFT_LIMIT, EPOCH);
+  CHECK(loadedTime(EPOCH + 86400UL) == EPOCH + 86400UL - 17);   // the valid record is used
+  RTCSim.reg[8 + DS1307_DRIFT_ADDRESS + 5] ^= 0x01;
+  CHECK(loadedTime(EPOCH + 86400UL) == EPOCH + 86400UL);
+
+  // setTime() and setDateTimeRTC() restart the calibration from the new time, in any mode
+  DS1307new setter;
+  writeRecord(DS1307_DRIFT_LIMIT, EPOCH);
+  setChip(EPOCH + 1000000UL);
+  setter.fillByTime2000(EPOCH + 2000000UL);
+  setter.setTime();
+  CHECK(loadedTime(EPOCH + 2086400UL) == EPOCH + 2086400UL - 17);
+  setChip(EPOCH + 3000000UL);
+  setter.setDateTimeRTC();
+  CHECK(loadedTime(setter.time2000 + 86400UL) == setter.time2000 + 86400UL - 17);
+  CHECK(setter.getDrift() == DS1307_DRIFT_LIMIT);
+
+  // calibrate() against the reference, then set the chip automatically
+  RTCSim.reg[8 + DS1307_DRIFT_ADDRESS] = 0xff;   // not calibrated
+  RTC.setDriftCompensation(DS1307_DRIFT_OFF);
+  RTCSim.drift = SIM_DRIFT;
+  RTCSim.setDateTime(2020, 1, 1, 0, 0, 0);
+  RTCSim.reg[0] &= 0x7f;                // oscillator running
+  DS1307new start;
+  start.fillByYMD(2020, 1, 1);
+  start.fillByHMS(0, 0, 0);
+  referenceBase = start.time2000;
+  lastMicros = micros();
+  CHECK(!RTC.calibrate(reference()));   // first calibration point
+  run(7 * 86400UL);
+  CHECK(RTC.calibrate(reference()));
+  run(30 * 86400UL);
+  CHECK(RTC.calibrate(reference()));
+  CHECK(RTC.getDrift() > SIM_DRIFT - 100 && RTC.getDrift() < SIM_DRIFT + 100);
+
+  // a sketch that reads once a second never catches the tick: only the object is corrected
+  RTC.setDriftCompensation(DS1307_DRIFT_AUTO_SET);
+  run(3 * 86400UL);
+  for( int n = 0; n < 5; n++ )
+  {
+    uint32_t before = millis();
+    RTC.getTime();
+    CHECK(millis() - before < 10);     // no waiting for the tick
+    CHECK(RTC.time2000 - reference() + 1 <= 3);
+    delay(1000);
+  }
+  CHECK(chipError() >= 5);
+
+  // reads every 20 ms catch the tick and set the chip, keeping the phase
+  for( int day = 0; day < 40; day++ )
+  {
+    run(86400UL);
+    for( int n = 0; n < 60; n++ )
+    {
+      uint32_t before = millis();
+      RTC.getTime();
+      CHECK(millis() - before < 10);
+      CHECK(RTC.time2000 - reference() + 1 <= 3);
+      delay(20);
+    }
+  }
+  CHECK(chipError() + 1 <= 3);
+  return checkResult("drift compensation");
+}
@@ -0,0 +1,96 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_fastpoll_check.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # getTime() in the fast poll mode against a second object that always
+// # reads all registers: the times agree (within the second that can pass
+// # between the two reads), all fields stay consistent, and the minute,
+// # hour and date registers are read at least once a minute, so a clock
+// # set by another master is seen within a minute.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Arduino.h"
+#include "Wire.h"
+#include "DS1307Sim.h"
+#include "DS1307new.h"
+#include "HostCheck.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define POLLS 20000
+#define FULL_READ_BYTES 5               // a seconds only read is 4 bytes on the wire
+
+// *********************************************
+// Helpers
+// *********************************************
+static DS1307new reference(Wire);
+
+static boolean consistent(DS1307new &t)
+{
+  DS1307new c;
+  c.fillByTime2000(t.time2000);
+  return c.second == t.second && c.minute == t.minute && c.hour == t.hour && c.day == t.day
+    && c.month == t.month && c.year == t.year && c.dow == t.dow && c.cdn == t.cdn && c.ydn == t.ydn;
+}
+
+// polls every 137 ms (with some 45 s pauses), returns the polls without a full read in a row at most
+static unsigned long poll(int polls, boolean pauses)
+{
+  unsigned long fast = 0, longest = 0;
+  for( int i = 0; i < polls; i++ )
+  {
+    uint32_t before = Wire.stats.bytes;
+    RTC.getTime();
+    if ( Wire.stats.bytes - before > FULL_READ_BYTES )
+      fast = 0;
+    else if ( ++fast > longest )
+      longest = fast;
+    reference.getTime();
+    CHECK(reference.time2000 - RTC.time2000 <= 1);
+    CHECK(consistent(RTC));
+    delay(pauses && i % 97 == 0 ? 45000 : 137);
+  }
+  return longest;
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  RTCSim.setDateTime(2024, 2, 28, 23, 58, 30);
+  RTCSim.reg[0] &= 0x7f;                // oscillator running
+  RTC.enableFastPoll();
+
+  poll(POLLS, true);
+  // at most a minute (438 polls of 137 ms) without reading the minutes
+  CHECK(poll(2000, false) <= 60000 / 137 + 1);
+
+  // another master changes the hour register, the seconds run on
+  poll(10, false);
+  RTCSim.reg[2] = RTCSim.reg[2] == 0x05 ? 0x06 : 0x05;
+  int polls = 0;
+  do
+  {
+    delay(137);
+    RTC.getTime();
+    reference.getTime();
+  } while( RTC.hour != reference.hour && ++polls <= 60000 / 137 + 1 );
+  CHECK(RTC.hour == reference.hour && RTC.time2000 == reference.time2000);
+
+  // set forwards and backwards within the minute, and changed by the sketch
+  RTCSim.setDateTime(2024, 2, 28, 23, 58, 50);
+  poll(100, false);
+  RTCSim.setDateTime(2024, 2, 28, 23, 58, 5);
+  poll(100, false);
+  RTC.fillByTime2000(RTC.time2000 + 3600);
+  poll(100, false);
+  return checkResult("fast poll getTime()");
+}
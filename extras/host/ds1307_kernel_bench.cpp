@@ -0,0 +1,436 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_kernel_bench.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Equivalence checks and timing of the date kernels and the bus paths.
+// # First every kernel is compared with a plain loop based reference over
+// # the whole time2000 range (2000-01-01 .. 2136-02-07), then each one is
+// # timed in ns per call and, where the kernel allows perf_event_open(),
+// # in instructions per call. The bus paths also report the bytes on the
+// # simulated I2C bus per call.
+// # With --exhaustive fillByTime2000() is compared for every time2000 and
+// # the year kernels for every 16 bit year instead (make divfree-check
+// # runs this against the DS1307_DIVISION_FREE build, a few minutes).
+// # Exit code 1 if a kernel differs from the reference.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "Arduino.h"
+#include "Wire.h"
+#include "DS1307Sim.h"
+#include "DS1307new.h"
+
+#ifndef DS1307_KERNEL_BENCH
+#error "build with -DDS1307_KERNEL_BENCH (see Makefile), the kernels are private to DS1307new"
+#endif
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define CALLS (1UL << 20)
+#define BUS_CALLS 2000UL
+#define RUNS 5
+#define LAST_CDN 49710                  // 2136-02-07, the day time2000 ends
+#define REF_DAYS (LAST_CDN + 366)       // the reference covers all of 2136
+
+// *********************************************
+// Access to the private kernels
+// *********************************************
+class DS1307newKernelBench
+{
+  public:
+    static void calculate_ydn(DS1307new &t) { t.calculate_ydn(); }
+    static void calculate_month_by_year_and_ydn(DS1307new &t) { t.calculate_month_by_year_and_ydn(); }
+    static uint8_t dec2bcd(DS1307new &t, uint8_t v) { return t.dec2bcd(v); }
+    static uint8_t bcd2dec(DS1307new &t, uint8_t v) { return t.bcd2dec(v); }
+    static uint8_t is_leap_year(uint16_t y) { return DS1307new::is_leap_year(y); }
+    static uint16_t cdn_by_year_and_ydn(uint16_t y, uint16_t ydn) { return DS1307new::cdn_by_year_and_ydn(y, ydn); }
+};
+typedef DS1307newKernelBench K;
+
+// *********************************************
+// Reference implementation, one day at a time
+// *********************************************
+static boolean ref_leap(uint16_t y)
+{
+  return (y % 4 == 0 && y % 100 != 0) || y % 400 == 0;
+}
+
+static uint8_t ref_days_in_month(uint16_t y, uint8_t m)
+{
+  static const uint8_t days[12] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+  return m == 2 && ref_leap(y) ? 29 : days[m - 1];
+}
+
+struct ref_date
+{
+  uint16_t year, ydn;
+  uint8_t month, day, dow;
+};
+
+static ref_date ref_dates[REF_DAYS];
+static uint32_t ref_summer_begin[137], ref_summer_end[137];   // per year from 2000, time2000
+
+// CET/CEST in standard time: summer time from 02:00 of the last sunday of march to 02:00 of the last sunday of october
+static void ref_fill(void)
+{
+  ref_date d = { 2000, 1, 1, 1, 6 };    // 2000-01-01 was a saturday
+  for( uint32_t cdn = 0; cdn < REF_DAYS; cdn++ )
+  {
+    ref_dates[cdn] = d;
+    if ( d.dow == 0 && d.day + 7 > ref_days_in_month(d.year, d.month) )
+    {
+      if ( d.month == 3 )
+        ref_summer_begin[d.year - 2000] = cdn * 86400UL + 7200UL;
+      if ( d.month == 10 )
+        ref_summer_end[d.year - 2000] = cdn * 86400UL + 7200UL;
+    }
+    d.dow = (d.dow + 1) % 7;
+    d.ydn++;
+    if ( ++d.day > ref_days_in_month(d.year, d.month) )
+    {
+      d.day = 1;
+      if ( ++d.month > 12 )
+      {
+        d.month = 1;
+        d.year++;
+        d.ydn = 1;
+      }
+    }
+  }
+}
+
+static boolean ref_cet_summer(uint32_t t)
+{
+  uint16_t y = ref_dates[t / 86400UL].year - 2000;
+  return t >= ref_summer_begin[y] && t < ref_summer_end[y];
+}
+
+// *********************************************
+// Equivalence
+// *********************************************
+static unsigned long failures;
+
+static void fail(const char *what, uint32_t input)
+{
+  if ( failures++ < 10 )
+    printf("%s differs for %lu\n", what, (unsigned long)input);
+}
+
+static void check_kernels(void)
+{
+  DS1307new t;
+  for( uint32_t cdn = 0; cdn <= LAST_CDN; cdn++ )
+  {
+    const ref_date &r = ref_dates[cdn];
+    t.fillByCDN(cdn);
+    if ( t.year != r.year || t.ydn != r.ydn || t.month != r.month || t.day != r.day || t.dow != r.dow
+        || t.time2000 != cdn * 86400UL )
+      fail("fillByCDN", cdn);
+    t.fillByYMD(r.year, r.month, r.day);
+    if ( t.cdn != cdn || t.ydn != r.ydn || t.dow != r.dow || t.time2000 != cdn * 86400UL )
+      fail("fillByYMD", cdn);
+    t.year = r.year;
+    t.month = r.month;
+    t.day = r.day;
+    K::calculate_ydn(t);
+    if ( t.ydn != r.ydn )
+      fail("calculate_ydn", cdn);
+    t.month = 0;
+    K::calculate_month_by_year_and_ydn(t);
+    if ( t.month != r.month )
+      fail("calculate_month_by_year_and_ydn", cdn);
+  }
+  // every second of the first and the last day, one stamp per 97 s in between
+  for( uint64_t s = 0; s <= 0xffffffffULL; s += s < 86400UL || s > 0xffffffffULL - 86400UL ? 1 : 97 )
+  {
+    const ref_date &r = ref_dates[s / 86400UL];
+    uint32_t sod = s % 86400UL;
+    t.fillByTime2000((uint32_t)s);
+    if ( t.year != r.year || t.month != r.month || t.day != r.day || t.dow != r.dow
+        || t.hour != sod / 3600 || t.minute != sod / 60 % 60 || t.second != sod % 60 )
+      fail("fillByTime2000", (uint32_t)s);
+  }
+  for( uint8_t v = 0; v < 100; v++ )
+  {
+    uint8_t bcd = ((v / 10) << 4) | (v % 10);
+    if ( K::dec2bcd(t, v) != bcd || K::bcd2dec(t, bcd) != v )
+      fail("dec2bcd/bcd2dec", v);
+  }
+  for( uint32_t s = 0; s <= 0xffffffffUL - 1800UL; s += 1800UL )
+  {
+    t.fillByTime2000(s);
+    if ( (t.isCETSummerTime() != 0) != ref_cet_summer(s) )
+      fail("isCETSummerTime", s);
+  }
+}
+
+// every second of the time2000 range and every year the kernels accept
+static void check_exhaustive(void)
+{
+  DS1307new t;
+  uint32_t s = 0;
+  do
+  {
+    t.fillByTime2000(s);
+    const ref_date &r = ref_dates[s / 86400UL];
+    uint32_t sod = s % 86400UL;
+    if ( t.year != r.year || t.month != r.month || t.day != r.day || t.dow != r.dow || t.ydn != r.ydn
+        || t.hour != sod / 3600 || t.minute != sod / 60 % 60 || t.second != sod % 60 )
+      fail("fillByTime2000", s);
+  } while( ++s != 0 );
+  for( uint32_t y = 0; y <= 0xffffUL; y++ )
+  {
+    uint16_t c = 0;                     // the 16 bit arithmetic of cdn_by_year_and_ydn() with divisions
+    uint16_t yy = y >= 2000 ? y - 2000 : 0;
+    c += yy * 365;
+    c += (uint16_t)(yy + 3) / 4;
+    c -= (uint16_t)(yy + 99) / 100;
+    c += (uint16_t)(yy + 399) / 400;
+    if ( (K::is_leap_year(y) != 0) != ref_leap(y) )
+      fail("is_leap_year", y);
+    if ( K::cdn_by_year_and_ydn(y, 1) != c )
+      fail("cdn_by_year_and_ydn", y);
+  }
+}
+
+// *********************************************
+// Timing
+// *********************************************
+static double now_seconds(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// user space instructions, -1 if perf events are not available (container, perf_event_paranoid)
+static int perf_fd = -1;
+
+static void perf_open(void)
+{
+  struct perf_event_attr a;
+  memset(&a, 0, sizeof(a));
+  a.size = sizeof(a);
+  a.type = PERF_TYPE_HARDWARE;
+  a.config = PERF_COUNT_HW_INSTRUCTIONS;
+  a.exclude_kernel = 1;
+  a.exclude_hv = 1;
+  perf_fd = syscall(SYS_perf_event_open, &a, 0, -1, -1, 0);
+}
+
+static long long perf_read(void)
+{
+  long long v = 0;
+  if ( perf_fd < 0 || read(perf_fd, &v, sizeof(v)) != sizeof(v) )
+    return -1;
+  return v;
+}
+
+static uint32_t stamps[CALLS];
+static uint16_t days[CALLS];
+static volatile uint32_t sink;         // keeps the results alive
+
+static DS1307new subject;
+
+static void run_fillByTime2000(void)
+{
+  for( size_t i = 0; i < CALLS; i++ )
+  {
+    subject.fillByTime2000(stamps[i]);
+    sink += subject.day;
+  }
+}
+
+static void run_fillByCDN(void)
+{
+  for( size_t i = 0; i < CALLS; i++ )
+  {
+    subject.fillByCDN(days[i]);
+    sink += subject.day;
+  }
+}
+
+static void run_fillByYMD(void)
+{
+  for( size_t i = 0; i < CALLS; i++ )
+  {
+    const ref_date &r = ref_dates[days[i]];
+    subject.fillByYMD(r.year, r.month, r.day);
+    sink += subject.cdn;
+  }
+}
+
+static void run_calculate_ydn(void)
+{
+  for( size_t i = 0; i < CALLS; i++ )
+  {
+    const ref_date &r = ref_dates[days[i]];
+    subject.year = r.year;
+    subject.month = r.month;
+    subject.day = r.day;
+    K::calculate_ydn(subject);
+    sink += subject.ydn;
+  }
+}
+
+static void run_calculate_month(void)
+{
+  for( size_t i = 0; i < CALLS; i++ )
+  {
+    const ref_date &r = ref_dates[days[i]];
+    subject.year = r.year;
+    subject.ydn = r.ydn;
+    K::calculate_month_by_year_and_ydn(subject);
+    sink += subject.month;
+  }
+}
+
+static void run_bcd(void)
+{
+  for( size_t i = 0; i < CALLS; i++ )
+    sink += K::bcd2dec(subject, K::dec2bcd(subject, i % 100));
+}
+
+// hour by hour, as a sketch calls it
+static void run_isCETSummerTime(void)
+{
+  for( size_t i = 0; i < CALLS; i++ )
+  {
+    subject.fillByTime2000(i * 3600UL);
+    sink += subject.isCETSummerTime();
+  }
+}
+
+// bus paths, against the simulated DS1307
+static void run_getTime(void)
+{
+  for( size_t i = 0; i < BUS_CALLS; i++ )
+    RTC.getTime();
+}
+
+static void run_snapshot(void)
+{
+  for( size_t i = 0; i < BUS_CALLS; i++ )
+    RTC.snapshot();
+}
+
+// minute by minute, a few of the calls find an alarm
+static void run_isAlarmTime(void)
+{
+  for( size_t i = 0; i < BUS_CALLS; i++ )
+  {
+    RTC.addMinutes(1);
+    while( RTC.isAlarmTime() )
+      ;
+  }
+}
+
+struct kernel
+{
+  const char *name;
+  void (*run)(void);
+  size_t calls;
+  boolean bus;
+};
+
+static const kernel kernels[] =
+{
+  { "fillByTime2000", run_fillByTime2000, CALLS, false },
+  { "fillByCDN", run_fillByCDN, CALLS, false },
+  { "fillByYMD", run_fillByYMD, CALLS, false },
+  { "calculate_ydn", run_calculate_ydn, CALLS, false },
+  { "calculate_month_by_year_and_ydn", run_calculate_month, CALLS, false },
+  { "dec2bcd + bcd2dec", run_bcd, CALLS, false },
+  { "isCETSummerTime", run_isCETSummerTime, CALLS, false },
+  { "getTime", run_getTime, BUS_CALLS, true },
+  { "snapshot", run_snapshot, BUS_CALLS, true },
+  { "isAlarmTime", run_isAlarmTime, BUS_CALLS, true },
+};
+
+// best of RUNS
+static void measure(const kernel &k)
+{
+  double best = 1e30;
+  long long instructions = -1;
+  double bytes = 0;
+  for( int r = 0; r < RUNS; r++ )
+  {
+    Wire.stats.clear();
+    long long i0 = perf_read();
+    double start = now_seconds();
+    k.run();
+    double t = now_seconds() - start;
+    long long i1 = perf_read();
+    if ( t < best )
+    {
+      best = t;
+      instructions = i0 < 0 || i1 < 0 ? -1 : i1 - i0;
+      bytes = (double)Wire.stats.bytes / k.calls;
+    }
+  }
+  printf("%-32s %10.1f", k.name, best * 1e9 / k.calls);
+  if ( instructions < 0 )
+    printf(" %12s", "n/a");
+  else
+    printf(" %12.1f", (double)instructions / k.calls);
+  if ( k.bus )
+    printf(" %10.2f", bytes);
+  printf("\n");
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(int argc, char **argv)
+{
+  boolean exhaustive = argc > 1 && strcmp(argv[1], "--exhaustive") == 0;
+  ref_fill();
+  if ( exhaustive )
+    check_exhaustive();
+  else
+    check_kernels();
+  if ( failures != 0 )
+  {
+    printf("%lu differences to the reference\n", failures);
+    return 1;
+  }
+  printf("all kernels equal the reference over 2000-01-01 .. 2136-02-07\n\n");
+  if ( exhaustive )
+    return 0;
+
+  uint32_t x = 2463534242UL;
+  for( size_t i = 0; i < CALLS; i++ )   // xorshift32, covers the whole time2000 range
+  {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    stamps[i] = x;
+    days[i] = x % (LAST_CDN + 1);
+  }
+
+  RTCSim.setDateTime(2012, 7, 30, 5, 30, 0);
+  RTCSim.reg[0] &= 0x7f;                // oscillator running
+  RTC.getTime();
+  RTC.clearAlarmNvramMemory();
+  RTC.addAlarm(5, 25, DS1307_EVERY_DAY);
+  RTC.addAlarm(16, 35, 0x3e);
+
+  perf_open();
+  printf("%-32s %10s %12s %10s\n", "call", "ns/call", "instr/call", "bus bytes");
+  for( size_t i = 0; i < sizeof(kernels) / sizeof(kernels[0]); i++ )
+    measure(kernels[i]);
+  if ( perf_fd < 0 )
+    printf("(instruction counts need perf_event_open(), see /proc/sys/kernel/perf_event_paranoid)\n");
+  return 0;
+}
@@ -0,0 +1,86 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_millis_check.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # getTimeMillis() with the software clock on SQW interrupt 2, for
+// # crystals that are exact, 50 ppm fast and 70 ppm slow. Reads at random
+// # intervals over 75 minutes each (micros() wraps after 71.6 minutes):
+// # the time in ms never goes backwards and stays within 1 ms of the time
+// # of the simulated crystal.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <stdlib.h>
+#include "Arduino.h"
+#include "Wire.h"
+#include "DS1307Sim.h"
+#include "DS1307new.h"
+#include "HostCheck.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define RUN_MICROS (75ULL * 60 * 1000000)
+#define SETTLE_MICROS 3000000ULL        // the first seconds measure the length of a second
+#define MAX_ERROR_MS 1
+
+// *********************************************
+// Helpers
+// *********************************************
+static uint64_t hostMicros;
+static uint32_t lastMicros;
+
+static uint64_t elapsedMicros(void)
+{
+  uint32_t m = micros();
+  hostMicros += (uint32_t)(m - lastMicros);
+  lastMicros = m;
+  return hostMicros;
+}
+
+static void run(int32_t drift)
+{
+  DS1307new start;
+  int64_t previous = 0;
+  uint64_t begin;
+
+  RTCSim.drift = drift;
+  RTCSim.setDateTime(2020, 1, 1, 0, 0, 0);
+  RTCSim.reg[0] &= 0x7f;                // oscillator running from here on
+  begin = elapsedMicros();
+  start.fillByYMD(2020, 1, 1);
+  start.fillByHMS(0, 0, 0);
+  RTC.enableSoftwareClock(2, 10);
+  srand(3);
+  while( elapsedMicros() - begin < RUN_MICROS )
+  {
+    hostAdvance(rand() % 300000);
+    uint16_t ms = RTC.getTimeMillis();
+    uint64_t us = elapsedMicros() - begin;
+    int64_t got = (int64_t)(RTC.time2000 - start.time2000) * 1000 + ms;
+    int64_t crystal = (int64_t)(us + (int64_t)us * drift / 100000000LL) / 1000;
+    CHECK(ms < 1000);
+    CHECK(got >= previous);
+    if ( us > SETTLE_MICROS )
+      CHECK(got - crystal >= -MAX_ERROR_MS && got - crystal <= MAX_ERROR_MS);
+    previous = got;
+  }
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  RTCSim.sqwInterrupt = 2;
+  lastMicros = micros();
+  run(0);
+  run(5000);                            // 0.01 ppm
+  run(-7000);
+  return checkResult("getTimeMillis()");
+}
@@ -0,0 +1,170 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_scheduler_check.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # DS1307newScheduler: the requests of several clients in one burst, the
+// # freshness window and its end by a write of the object, the merge gap,
+// # a read of all registers in Wire buffer sized chunks, the full queue,
+// # NVRAM served from the RAM mirror and from the writes of an open batch
+// # (also by the split read beginGetRAM() of the object),
+// # and a device that does not answer (no RAM mirror either). Bursts are
+// # counted as STOPs.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Arduino.h"
+#include "Wire.h"
+#include "DS1307Sim.h"
+#include "DS1307new.h"
+#include "DS1307newScheduler.h"
+#include "HostCheck.h"
+
+// *********************************************
+// Helpers
+// *********************************************
+// NVRAM content before the checks: register r holds 3 r
+static uint8_t pattern(uint8_t reg)
+{
+  return reg * 3;
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  DS1307new rtc;
+  DS1307newScheduler sched(rtc);
+  uint8_t log[8], ctrl, header[3], all[DS1307_REGISTER_COUNT], a[2], b[2], v;
+  DS1307newTime published;
+
+  RTCSim.setDateTime(2012, 7, 30, 5, 30, 7);
+  RTCSim.reg[0] &= 0x7f;                // oscillator running
+  RTCSim.reg[7] = 0x10;                 // SQW 1 Hz
+  for( uint8_t r = 8; r < DS1307_REGISTER_COUNT; r++ )
+    RTCSim.reg[r] = pattern(r);
+
+  // three clients, five requests, one burst
+  Wire.stats.clear();
+  CHECK(sched.requestTime());
+  CHECK(sched.requestRAM(0, log, 8));
+  CHECK(sched.requestRegisters(7, &ctrl, 1));
+  CHECK(sched.requestTime());
+  CHECK(sched.requestRAM(1, header, 3));
+  CHECK(sched.getPending() == 5);
+  CHECK(sched.service() == 0);
+  CHECK(Wire.stats.stops == 1);
+  CHECK(ctrl == 0x10 && header[0] == pattern(9));
+  for( uint8_t i = 0; i < 8; i++ )
+    CHECK(log[i] == pattern(8 + i));
+  CHECK(rtc.year == 2012 && rtc.hour == 5 && rtc.minute == 30 && rtc.second == 7);
+  CHECK(rtc.readConsistent(published) && published.time2000 == rtc.time2000);
+
+  // freshness 0: every service() reads
+  Wire.stats.clear();
+  sched.requestRegisters(7, &ctrl, 1);
+  sched.service();
+  CHECK(Wire.stats.stops == 1);
+
+  // freshness 1000 ms: only registers not read before
+  sched.setFreshness(1000);
+  sched.requestRegisters(7, &ctrl, 1);
+  sched.service();
+  Wire.stats.clear();
+  sched.requestRegisters(7, &ctrl, 1);
+  sched.requestRegisters(6, a, 2);
+  sched.service();
+  CHECK(Wire.stats.stops == 1);
+  Wire.stats.clear();
+  sched.requestRegisters(7, &ctrl, 1);
+  sched.service();
+  CHECK(Wire.stats.stops == 0);
+  delay(1000);
+  Wire.stats.clear();
+  sched.requestRegisters(7, &ctrl, 1);
+  sched.service();
+  CHECK(Wire.stats.stops == 1);
+
+  // a write of the object ends the window
+  v = 0x42;
+  rtc.setRAM(5, &v, 1);
+  Wire.stats.clear();
+  sched.requestRAM(5, a, 1);
+  sched.service();
+  CHECK(a[0] == 0x42 && Wire.stats.stops == 1);
+  sched.setFreshness(0);
+
+  // a gap of DS1307_READ_MERGE_GAP registers is read along, a larger one is not
+  Wire.stats.clear();
+  sched.requestRegisters(8, a, 2);
+  sched.requestRegisters(10 + DS1307_READ_MERGE_GAP, b, 2);
+  sched.service();
+  CHECK(Wire.stats.stops == 1);
+  Wire.stats.clear();
+  sched.requestRegisters(8, a, 2);
+  sched.requestRegisters(11 + DS1307_READ_MERGE_GAP, b, 2);
+  sched.service();
+  CHECK(Wire.stats.stops == 2);
+  CHECK(a[0] == pattern(8) && b[1] == pattern(12 + DS1307_READ_MERGE_GAP));
+
+  // all registers in two chunks of the Wire buffer
+  Wire.stats.clear();
+  sched.requestRegisters(0, all, DS1307_REGISTER_COUNT);
+  CHECK(sched.service() == 0);
+  CHECK(Wire.stats.stops == 2);
+  CHECK(all[7] == 0x10 && all[63] == pattern(63));
+
+  // ranges beyond register 0x3F and a full queue are refused
+  CHECK(!sched.requestRegisters(60, all, 5));
+  CHECK(!sched.requestRAM(50, all, 7));
+  CHECK(sched.getPending() == 0);
+  for( uint8_t i = 0; i < DS1307_SCHEDULER_QUEUE; i++ )
+    CHECK(sched.requestRegisters(i, a, 1));
+  CHECK(!sched.requestRegisters(0, a, 1));
+  sched.service();
+
+  // NVRAM from the RAM mirror, not written to the chip yet
+  rtc.enableNvramCache(DS1307_NVRAM_MANUAL_FLUSH);
+  v = 0x77;
+  rtc.setRAM(2, &v, 1);
+  Wire.stats.clear();
+  sched.requestRAM(0, log, 8);
+  sched.service();
+  CHECK(Wire.stats.stops == 0);
+  CHECK(log[2] == 0x77 && RTCSim.reg[10] != 0x77);
+  rtc.disableNvramCache();
+
+  // the writes of an open batch without the mirror: served from the object, the rest from the chip
+  rtc.beginNvramBatch();
+  v = 0x55;
+  rtc.setRAM(20, &v, 1);
+  Wire.stats.clear();
+  sched.requestRAM(18, log, 5);
+  sched.requestTime();
+  sched.service();
+  CHECK(Wire.stats.stops == 2);         // registers 0x00 - 0x06 and 0x1A - 0x1E
+  CHECK(log[2] == 0x55 && RTCSim.reg[28] == pattern(28));
+  CHECK(log[0] == pattern(26) && log[1] == pattern(27) && log[3] == pattern(29) && log[4] == pattern(30));
+  memset(log, 0, sizeof(log));
+  CHECK(rtc.beginGetRAM(18, log, 5));   // the split read of the object gives the same bytes
+  while( rtc.isBusy() )
+    rtc.poll();
+  CHECK(rtc.isReady() && log[2] == 0x55 && log[1] == pattern(27) && log[3] == pattern(29));
+  rtc.commit();
+  CHECK(RTCSim.reg[28] == 0x55);
+
+  // no device at the address
+  DS1307new absent(Wire, 0x50);
+  DS1307newScheduler other(absent);
+  other.requestTime();
+  other.requestRegisters(7, &ctrl, 1);
+  CHECK(other.service() == 2);
+  CHECK(!absent.enableNvramCache());    // the mirror is not filled with what the bus left behind
+  CHECK(!absent.isRamHeld(0));
+  return checkResult("DS1307newScheduler");
+}
@@ -0,0 +1,102 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_seqlock_stress.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # Stress test of publishTime() / readConsistent() with threads: one
+// # writer publishes time stamps as fast as it can, the other threads read
+// # them and check every copy. A copy is torn if its fields do not belong
+// # to its time2000 or if time2000 is not one the writer has published.
+// # The writer steps by 33 days, 1 hour, 1 minute and 1 second, so that
+// # (nearly) every field changes with each publish.
+// # Exit code 1 on a torn copy.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <stdio.h>
+#include <stdlib.h>
+#include <thread>
+#include <atomic>
+#include "Arduino.h"
+#include "DS1307new.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define PUBLISHES 20000000UL
+#define STEP (33 * 86400UL + 3661UL)
+#define MAX_READERS 16
+
+// *********************************************
+// Threads
+// *********************************************
+static DS1307new shared;
+static std::atomic<bool> done(false);
+static unsigned long reads[MAX_READERS];
+static unsigned long torn[MAX_READERS];
+
+static void writer(void)
+{
+  uint32_t t = 0;
+  for( unsigned long i = 0; i < PUBLISHES; i++ )
+  {
+    shared.fillByTime2000(t);
+    shared.publishTime();
+    t += STEP;
+    if ( t > 0xffffffffUL - STEP )
+      t = 0;
+  }
+  done = true;
+}
+
+static void reader(int n)
+{
+  DS1307newTime t;
+  DS1307new expected;
+  while( !done )
+  {
+    if ( !shared.readConsistent(t) )
+      continue;
+    reads[n]++;
+    expected.fillByTime2000(t.time2000);
+    if ( t.year != expected.year || t.month != expected.month || t.day != expected.day
+        || t.hour != expected.hour || t.minute != expected.minute || t.second != expected.second
+        || t.dow != expected.dow || t.time2000 % STEP != 0 )
+    {
+      if ( torn[n]++ < 5 )
+        printf("reader %d: torn copy, time2000 %lu, %04u-%02u-%02u %02u:%02u:%02u dow %u\n", n,
+          (unsigned long)t.time2000, t.year, t.month, t.day, t.hour, t.minute, t.second, t.dow);
+    }
+  }
+}
+
+// *********************************************
+// Main
+// *********************************************
+int main(int argc, char **argv)
+{
+  int readers = argc > 1 ? atoi(argv[1]) : (int)std::thread::hardware_concurrency() - 1;
+  if ( readers < 1 )
+    readers = 1;
+  if ( readers > MAX_READERS )
+    readers = MAX_READERS;
+
+  std::thread threads[MAX_READERS];
+  for( int i = 0; i < readers; i++ )
+    threads[i] = std::thread(reader, i);
+  std::thread w(writer);
+  w.join();
+  unsigned long total = 0, bad = 0;
+  for( int i = 0; i < readers; i++ )
+  {
+    threads[i].join();
+    total += reads[i];
+    bad += torn[i];
+  }
+  printf("%lu publishes, %d readers, %lu consistent reads, %lu torn\n", PUBLISHES, readers, total, bad);
+  return bad != 0;
+}
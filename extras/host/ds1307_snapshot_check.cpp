@@ -0,0 +1,95 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_snapshot_check.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # snapshot() against getTime() and getCTRL(), the time-set token served
+// # from the burst after direct and batched NVRAM writes, the bus cost of a
+// # loop of snapshot(), isTimeSet() and isAlarmTime(), and a device that
+// # does not answer.
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include "Arduino.h"
+#include "Wire.h"
+#include "DS1307Sim.h"
+#include "DS1307new.h"
+#include "HostCheck.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define SNAPSHOT_BYTES 15               // address, pointer, address, registers 0x00 - 0x0B
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  DS1307new a, b;
+  uint8_t token;
+
+  RTCSim.setDateTime(2012, 7, 30, 5, 30, 7);
+  RTCSim.reg[0] &= 0x7f;                // oscillator running
+  RTCSim.reg[7] = 0x10;                 // SQW 1 Hz
+  RTCSim.reg[8] = 0xa5;                 // time-set token
+
+  // the same values as getTime() and getCTRL()
+  a.getTime();
+  a.getCTRL();
+  CHECK(b.snapshot());
+  CHECK(b.time2000 == a.time2000 && b.second == a.second && b.dow == a.dow && b.ydn == a.ydn);
+  CHECK(b.ctrl == a.ctrl && b.ctrl == 0x10);
+
+  // the token comes from the burst
+  Wire.stats.clear();
+  CHECK(b.isTimeSet());
+  CHECK(Wire.stats.transactions == 0);
+
+  // a write of the token is seen, the burst is not used anymore
+  token = 0xff;
+  b.setRAM(0, &token, 1);
+  Wire.stats.clear();
+  CHECK(!b.isTimeSet());
+  CHECK(Wire.stats.stops == 1);
+  CHECK(b.snapshot());
+  CHECK(!b.isTimeSet());
+
+  // a batched write is seen before and after the commit
+  b.beginNvramBatch();
+  token = 0xa5;
+  b.setRAM(0, &token, 1);
+  CHECK(b.isTimeSet());
+  b.commit();
+  CHECK(RTCSim.reg[8] == 0xa5);
+
+  // getTime() ends the use of the burst
+  b.snapshot();
+  b.getTime();
+  Wire.stats.clear();
+  CHECK(b.isTimeSet());
+  CHECK(Wire.stats.stops == 1);
+
+  // a loop of snapshot(), isTimeSet() and isAlarmTime() is one burst
+  b.clearAlarmNvramMemory();
+  b.addAlarm(23, 59, DS1307_EVERY_DAY);
+  b.snapshot();
+  b.isAlarmTime();                      // fills the cache of the next alarm
+  Wire.stats.clear();
+  CHECK(b.snapshot());
+  CHECK(b.isTimeSet());
+  CHECK(!b.isAlarmTime());
+  CHECK(Wire.stats.stops == 1 && Wire.stats.bytes == SNAPSHOT_BYTES);
+
+  // no device at the address: the object is unchanged
+  DS1307new c(Wire, 0x50);
+  c.fillByTime2000(12345);
+  c.ctrl = 0x03;
+  CHECK(!c.snapshot());
+  CHECK(c.time2000 == 12345 && c.second == 45 && c.ctrl == 0x03);
+  return checkResult("snapshot()");
+}
@@ -0,0 +1,75 @@
+// #############################################################################
+// #
+// # Scriptname : ds1307_unix_check.cpp
+// # Contributor: Milé Buurmeijer
+// # License    : cc-by-sa-3.0
+// #
+// # Description:
+// # The Unix time conversions against timegm() for random time2000 values
+// # in both directions, the saturation of unixToTime2000(), and
+// # DS1307newClock around 2038-01-19 03:14:08 (2^31 s Unix time).
+// #
+// #############################################################################
+// *********************************************
+// INCLUDE
+// *********************************************
+#include <time.h>
+#include "Arduino.h"
+#include "Wire.h"
+#include "DS1307Sim.h"
+#include "DS1307newChrono.h"
+#include "HostCheck.h"
+
+// *********************************************
+// DEFINE
+// *********************************************
+#define VALUES 2000000UL
+
+// *********************************************
+// Main
+// *********************************************
+int main(void)
+{
+  uint32_t x = 2463534242UL;
+  DS1307new t, u;
+
+  for( unsigned long i = 0; i < VALUES; i++ )
+  {
+    x ^= x << 13;                       // xorshift32
+    x ^= x >> 17;
+    x ^= x << 5;
+    t.fillByTime2000(x);
+    struct tm tm = {};
+    tm.tm_year = t.year - 1900;
+    tm.tm_mon = t.month - 1;
+    tm.tm_mday = t.day;
+    tm.tm_hour = t.hour;
+    tm.tm_min = t.minute;
+    tm.tm_sec = t.second;
+    int64_t expected = timegm(&tm);
+    CHECK(t.unixTime() == expected);
+    u.fillByUnixTime(expected);
+    CHECK(u.time2000 == x && u.year == t.year && u.dow == t.dow);
+    if ( expected < 4294967296LL )
+      CHECK((int64_t)DS1307new::time2000ToUnix32(x) == expected);
+  }
+
+  // saturation at both ends of the time2000 range
+  CHECK(DS1307new::unixToTime2000(0) == 0);
+  CHECK(DS1307new::unixToTime2000(DS1307_UNIX_OFFSET) == 0);
+  CHECK(DS1307new::unixToTime2000(DS1307_UNIX_OFFSET + 1) == 1);
+  CHECK(DS1307new::unixToTime2000(1LL << 40) == DS1307_TIME2000_MAX);
+  CHECK(DS1307new::time2000ToUnix(DS1307_TIME2000_MAX) == DS1307_UNIX_OFFSET + 4294967295LL);
+
+  // the clock at the 32 bit time_t limit
+  RTCSim.setDateTime(2038, 1, 19, 3, 14, 8);
+  RTCSim.reg[0] &= 0x7f;                // oscillator running
+  DS1307newClock::time_point p = DS1307newClock::now();
+  CHECK(DS1307newClock::to_time_t(p) == 2147483648LL);
+  CHECK(DS1307newClock::to_time2000(p) == RTC.time2000);
+  CHECK(DS1307newClock::to_sys(p).time_since_epoch() == std::chrono::seconds(2147483648LL));
+  DS1307newClock::time_point q = DS1307newClock::now() + std::chrono::hours(24);
+  CHECK(std::chrono::duration_cast<std::chrono::seconds>(q - p).count() == 86400);
+  static_assert(!DS1307newClock::is_steady, "the chip can be set");
+  return checkResult("Unix time conversions");
+}